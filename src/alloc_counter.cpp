@@ -0,0 +1,61 @@
+#include "alloc_counter.h"
+
+#if defined(ZILG_COUNT_ALLOCATIONS)
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+
+static std::atomic<uint64_t> s_allocation_count{ 0 };
+
+
+uint64_t allocation_count()
+{
+    return s_allocation_count.load(std::memory_order_relaxed);
+}
+
+
+void* operator new(size_t size)
+{
+    s_allocation_count.fetch_add(1, std::memory_order_relaxed);
+
+    if (void* ptr = std::malloc(size ? size : 1))
+    {
+        return ptr;
+    }
+
+    throw std::bad_alloc();
+}
+
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+
+void operator delete[](void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+
+void operator delete(void* ptr, size_t size) noexcept
+{
+    std::free(ptr);
+}
+
+
+void operator delete[](void* ptr, size_t size) noexcept
+{
+    std::free(ptr);
+}
+
+#endif
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+
+// Define ZILG_COUNT_ALLOCATIONS to replace the global operator new with one that counts calls. Used to check that
+// the machine doesn't touch the heap once it has warmed up.
+#if defined(ZILG_COUNT_ALLOCATIONS)
+
+// Number of heap allocations made by the process so far
+uint64_t allocation_count();
+
+#endif
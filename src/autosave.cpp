@@ -0,0 +1,182 @@
+#include "autosave.h"
+
+#include "log.h"
+#include "snapshot_codec.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+
+static constexpr char autosave_magic[4] = { 'Z', 'S', 'A', 'V' };
+static constexpr uint8_t autosave_version = 1;
+
+
+Autosave::Autosave()
+{
+    _thread = std::thread(&Autosave::run, this);
+}
+
+
+Autosave::~Autosave()
+{
+    flush();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+
+    _wake.notify_one();
+    _thread.join();
+}
+
+
+bool Autosave::save(ZMachine& zm, const std::string& path)
+{
+    PendingSave pending;
+    pending.path = path;
+
+    if (!zm.snapshot(pending.snapshot))
+    {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::deque<PendingSave>::iterator it = _queue.begin();
+
+        while (it != _queue.end() && it->path != path)
+        {
+            ++it;
+        }
+
+        if (it != _queue.end())
+        {
+            *it = std::move(pending);
+        }
+        else
+        {
+            _queue.push_back(std::move(pending));
+        }
+    }
+
+    _wake.notify_one();
+    return true;
+}
+
+
+void Autosave::flush()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idle.wait(lock, [this]() { return _queue.empty() && !_writing; });
+}
+
+
+bool Autosave::restore(ZMachine& zm, const char* path)
+{
+    FILE* file = fopen(path, "rb");
+
+    if (!file)
+    {
+        logf("Autosave::restore: Failed to open '%s'\n", path);
+        return false;
+    }
+
+    std::vector<uint8_t> data;
+    uint8_t buffer[16 * 1024];
+    size_t count;
+
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        data.insert(data.end(), buffer, buffer + count);
+    }
+
+    fclose(file);
+
+    if (data.size() < 5 || memcmp(data.data(), autosave_magic, sizeof(autosave_magic)) || data[4] != autosave_version)
+    {
+        logf("Autosave::restore: '%s' is not a supported save file\n", path);
+        return false;
+    }
+
+    ZMachine::Snapshot snapshot;
+    return SnapshotCodec::decode(data.data() + 5, data.size() - 5, zm.initial_memory(), snapshot) && zm.restore(snapshot);
+}
+
+
+void Autosave::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (;;)
+    {
+        _wake.wait(lock, [this]() { return _stop || !_queue.empty(); });
+
+        if (_queue.empty())
+        {
+            return;
+        }
+
+        PendingSave pending = std::move(_queue.front());
+        _queue.pop_front();
+        _writing = true;
+        lock.unlock();
+
+        write(pending);
+
+        // Drop the snapshot's page references before reporting idle
+        pending = PendingSave();
+        lock.lock();
+        _writing = false;
+
+        if (_queue.empty())
+        {
+            _idle.notify_all();
+        }
+    }
+}
+
+
+bool Autosave::write(const PendingSave& save)
+{
+    std::vector<uint8_t> data(autosave_magic, autosave_magic + sizeof(autosave_magic));
+    data.push_back(autosave_version);
+    std::vector<uint8_t> encoded;
+
+    if (!SnapshotCodec::encode(save.snapshot, encoded))
+    {
+        return false;
+    }
+
+    data.insert(data.end(), encoded.begin(), encoded.end());
+
+    // Written beside the old save and renamed over it, so a crash never leaves a half written save
+    std::string temp_path = save.path + ".tmp";
+    FILE* file = fopen(temp_path.c_str(), "wb");
+
+    if (!file)
+    {
+        logf("Autosave::write: Failed to open '%s'\n", temp_path.c_str());
+        return false;
+    }
+
+    bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+    written = (fclose(file) == 0) && written;
+    std::error_code error;
+
+    if (written)
+    {
+        std::filesystem::rename(temp_path, save.path, error);
+    }
+
+    if (!written || error)
+    {
+        logf("Autosave::write: Failed to write '%s'\n", save.path.c_str());
+        std::filesystem::remove(temp_path, error);
+        return false;
+    }
+
+    return true;
+}
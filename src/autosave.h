@@ -0,0 +1,57 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "zmachine.h"
+
+
+/*
+    Autosave file layout:
+    4 bytes     - "ZSAV"
+    1 byte      - format version
+    encoded snapshot, see SnapshotCodec
+*/
+
+// Saves sessions without holding up their turns. save() only takes a snapshot, which copies the pages of dynamic
+// memory written since the session's last snapshot; encoding and writing happen on a background thread.
+class Autosave
+{
+public:
+    Autosave();
+    ~Autosave();
+
+    Autosave(const Autosave&) = delete;
+    Autosave& operator=(const Autosave&) = delete;
+
+    // The machine must be waiting for input. A save still queued for the same path is replaced by this one.
+    bool save(ZMachine& zm, const std::string& path);
+
+    // Blocks until every queued save has been written
+    void flush();
+
+    // Loads a save back into a machine with the same story loaded
+    static bool restore(ZMachine& zm, const char* path);
+
+private:
+    struct PendingSave
+    {
+        std::string path;
+        ZMachine::Snapshot snapshot;
+    };
+
+    std::deque<PendingSave> _queue;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _idle;
+    bool _writing = false;
+    bool _stop = false;
+    std::thread _thread;
+
+    void run();
+    static bool write(const PendingSave& save);
+};
@@ -0,0 +1,87 @@
+#include "blorb.h"
+
+#include "log.h"
+
+#include <algorithm>
+
+
+static uint32_t read32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+
+bool BlorbIndex::is_blorb(const uint8_t* data, size_t size)
+{
+    return size >= 12 && read32(data) == blorb_id("FORM") && read32(data + 8) == blorb_id("IFRS");
+}
+
+
+bool BlorbIndex::parse(const uint8_t* data, size_t size)
+{
+    /*
+        FORM <size> IFRS
+        RIdx <size> <count>, then count entries of usage, number, offset of the resource's chunk
+        chunks, each type, size and data padded to an even length
+
+        AIFF sounds are FORM chunks of their own and the resource is the whole chunk, header included. Everything
+        else is just the chunk's data.
+    */
+    _resources.clear();
+
+    if (!is_blorb(data, size) || size < 24 || read32(data + 12) != blorb_id("RIdx"))
+    {
+        logm("BlorbIndex::parse: Not a Blorb file\n");
+        return false;
+    }
+
+    // Sizes in the header are only trusted as far as the data goes
+    size = std::min<size_t>(size, (size_t)read32(data + 4) + 8);
+    uint32_t index_size = read32(data + 16);
+    uint32_t count = read32(data + 20);
+
+    if (index_size < 4 || (size_t)index_size + 20 > size || count > (index_size - 4) / 12)
+    {
+        logm("BlorbIndex::parse: Resource index truncated\n");
+        return false;
+    }
+
+    _resources.reserve(count);
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const uint8_t* entry = data + 24 + i * 12;
+        uint32_t usage = read32(entry);
+        uint32_t number = read32(entry + 4);
+        size_t start = read32(entry + 8);
+
+        if (start + 8 > size || (size_t)read32(data + start + 4) > size - start - 8)
+        {
+            logf("BlorbIndex::parse: Resource %u out of range\n", number);
+            _resources.clear();
+            return false;
+        }
+
+        Resource resource;
+        resource.type = read32(data + start);
+        resource.offset = start + 8;
+        resource.size = read32(data + start + 4);
+
+        if (resource.type == blorb_id("FORM"))
+        {
+            resource.offset = start;
+            resource.size += 8;
+        }
+
+        _resources.emplace(((uint64_t)usage << 32) | number, resource);
+    }
+
+    return true;
+}
+
+
+const BlorbIndex::Resource* BlorbIndex::find(uint32_t usage, uint32_t number) const
+{
+    std::unordered_map<uint64_t, Resource>::const_iterator it = _resources.find(((uint64_t)usage << 32) | number);
+    return it == _resources.end() ? nullptr : &it->second;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+
+// Four character code of an IFF chunk type or Blorb resource usage
+constexpr uint32_t blorb_id(const char (&id)[5])
+{
+    return ((uint32_t)(uint8_t)id[0] << 24) | ((uint8_t)id[1] << 16) | ((uint8_t)id[2] << 8) | (uint8_t)id[3];
+}
+
+
+// Resource index of a Blorb file, an IFF FORM of type IFRS whose first chunk (RIdx) lists each resource by usage and
+// number with the offset of its chunk. Parsing reads just the index; the data is only referred to, so it must outlive
+// the index.
+class BlorbIndex
+{
+public:
+    struct Resource
+    {
+        uint32_t type;      // Chunk type, such as ZCOD, PNG or AIFF
+        size_t offset;      // Offset of the resource's data in the file
+        size_t size;
+    };
+
+    static constexpr uint32_t Exec = blorb_id("Exec");
+    static constexpr uint32_t Pict = blorb_id("Pict");
+    static constexpr uint32_t Snd = blorb_id("Snd ");
+    static constexpr uint32_t Data = blorb_id("Data");
+    static constexpr uint32_t ZCOD = blorb_id("ZCOD");
+
+    static bool is_blorb(const uint8_t* data, size_t size);
+
+    bool parse(const uint8_t* data, size_t size);
+
+    // Null if there is no such resource
+    const Resource* find(uint32_t usage, uint32_t number) const;
+
+    size_t count() const { return _resources.size(); }
+
+private:
+    std::unordered_map<uint64_t, Resource> _resources;   // Keyed by usage << 32 | number
+};
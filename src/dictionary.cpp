@@ -0,0 +1,210 @@
+#include "dictionary.h"
+
+#include "log.h"
+
+#include <cstring>
+
+
+bool Dictionary::build(const uint8_t* memory, uint32_t memory_size, uint32_t addr, uint8_t word_length)
+{
+    /*
+        Dictionary table layout:
+        n                      - number of word separators
+        n bytes                - word separator ZSCII codes
+        1 byte                 - entry length
+        1 word (signed)        - entry count, negative for an unsorted (user) dictionary
+        entries
+    */
+    _slots.clear();
+    _mapped_slots = nullptr;
+    _slot_count = 0;
+    _shift = 64;
+    _word_length = word_length;
+    _addr = addr;
+    _end = addr;
+
+    _separators.clear();
+
+    for (CharClass& char_class : _char_class)
+    {
+        char_class = Letter;
+    }
+
+    _char_class[' '] = Space;
+
+    if (addr >= memory_size)
+    {
+        logf("Dictionary::build: Dictionary address %X out of range\n", addr);
+        return false;
+    }
+
+    uint8_t num_separators = memory[addr];
+    uint32_t header_size = 1 + num_separators + 3;
+
+    if (addr + header_size > memory_size)
+    {
+        logf("Dictionary::build: Dictionary at %X truncated\n", addr);
+        return false;
+    }
+
+    for (uint8_t i = 0; i < num_separators; ++i)
+    {
+        _char_class[memory[addr + 1 + i]] = Separator;
+        _separators.push_back(memory[addr + 1 + i]);
+    }
+
+    uint8_t entry_length = memory[addr + 1 + num_separators];
+    int16_t entry_count = (int16_t)((memory[addr + 2 + num_separators] << 8) | memory[addr + 3 + num_separators]);
+    uint32_t num_entries = entry_count < 0 ? -entry_count : entry_count;
+    uint32_t entries = addr + header_size;
+
+    if (entry_length < (word_length << 1) || entries + num_entries * entry_length > memory_size)
+    {
+        logf("Dictionary::build: Bad entry table at %X\n", addr);
+        return false;
+    }
+
+    // Power of two table at most half full
+    size_t capacity = 16;
+    _shift = 60;
+
+    while (capacity < num_entries * 2)
+    {
+        capacity <<= 1;
+        --_shift;
+    }
+
+    _slots.assign(capacity, Slot{});
+    _slot_count = capacity;
+
+    for (uint32_t i = 0; i < num_entries; ++i)
+    {
+        uint32_t entry = entries + i * entry_length;
+        uint64_t key = 0;
+
+        for (uint8_t w = 0; w < word_length; ++w)
+        {
+            key = (key << 16) | (memory[entry + (w << 1)] << 8) | memory[entry + (w << 1) + 1];
+        }
+
+        size_t slot = slot_for(key);
+
+        while (_slots[slot].key && _slots[slot].key != key)
+        {
+            slot = (slot + 1) & (capacity - 1);
+        }
+
+        if (_slots[slot].key == 0)
+        {
+            // First entry wins if a dictionary has duplicates
+            _slots[slot].key = key;
+            _slots[slot].addr = (uint16_t)entry;
+        }
+    }
+
+    _end = entries + num_entries * entry_length;
+    return true;
+}
+
+
+void Dictionary::serialize(std::vector<uint8_t>& data) const
+{
+    // Header, character classes, separators, then the slots on an 8 byte boundary
+    size_t slots_offset = (sizeof(ImageHeader) + sizeof(_char_class) + _separators.size() + 7) & ~(size_t)7;
+    data.assign(slots_offset + _slot_count * sizeof(Slot), 0);
+
+    ImageHeader header{ (uint32_t)_slot_count, _addr, _end, _shift, _word_length, (uint8_t)_separators.size(), 0 };
+    memcpy(data.data(), &header, sizeof(header));
+    memcpy(data.data() + sizeof(header), _char_class, sizeof(_char_class));
+    memcpy(data.data() + sizeof(header) + sizeof(_char_class), _separators.data(), _separators.size());
+
+    // Field by field so the padding in each slot stays zero and images are reproducible
+    Slot* dest = (Slot*)(data.data() + slots_offset);
+
+    for (size_t i = 0; i < _slot_count; ++i)
+    {
+        dest[i].key = slots()[i].key;
+        dest[i].addr = slots()[i].addr;
+    }
+}
+
+
+bool Dictionary::adopt(const uint8_t* data, size_t size)
+{
+    ImageHeader header;
+
+    if (size < sizeof(header))
+    {
+        return false;
+    }
+
+    memcpy(&header, data, sizeof(header));
+    size_t slots_offset = (sizeof(ImageHeader) + sizeof(_char_class) + header.separator_count + 7) & ~(size_t)7;
+
+    if (size != slots_offset + header.slot_count * sizeof(Slot) || (header.slot_count & (header.slot_count - 1)) ||
+        ((uintptr_t)(data + slots_offset) % alignof(Slot)))
+    {
+        return false;
+    }
+
+    _addr = header.addr;
+    _end = header.end;
+    _shift = header.shift;
+    _word_length = header.word_length;
+    memcpy(_char_class, data + sizeof(header), sizeof(_char_class));
+    _separators.assign(data + sizeof(header) + sizeof(_char_class), data + sizeof(header) + sizeof(_char_class) + header.separator_count);
+
+    _slots.clear();
+    _slots.shrink_to_fit();
+    _mapped_slots = (const Slot*)(data + slots_offset);
+    _slot_count = header.slot_count;
+    return true;
+}
+
+
+uint64_t Dictionary::make_key(const uint8_t* zchars, size_t count) const
+{
+    uint64_t key = 0;
+
+    for (uint8_t w = 0; w < _word_length; ++w)
+    {
+        uint16_t word = 0;
+
+        for (uint8_t c = 0; c < 3; ++c)
+        {
+            size_t i = (w * 3) + c;
+            word = (word << 5) | ((i < count) ? (zchars[i] & 0x1F) : 5);
+        }
+
+        if (w == _word_length - 1)
+        {
+            word |= 0x8000;
+        }
+
+        key = (key << 16) | word;
+    }
+
+    return key;
+}
+
+
+uint16_t Dictionary::find(uint64_t key) const
+{
+    if (_slot_count == 0)
+    {
+        return 0;
+    }
+
+    const Slot* table = slots();
+    size_t mask = _slot_count - 1;
+
+    for (size_t slot = slot_for(key); table[slot].key; slot = (slot + 1) & mask)
+    {
+        if (table[slot].key == key)
+        {
+            return table[slot].addr;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+// Host-endian hash index over a dictionary table. Encoded words are packed into a single integer key (32 bits for
+// two-word entries, 48 bits for three-word entries) so a lookup is a hash and, almost always, a single probe.
+class Dictionary
+{
+public:
+    enum CharClass : uint8_t
+    {
+        Letter,
+        Space,
+        Separator
+    };
+
+    // word_length is the number of 16-bit words of encoded text in each entry
+    bool build(const uint8_t* memory, uint32_t memory_size, uint32_t addr, uint8_t word_length);
+
+    // Flat copy of the index for a story image, and an index used in place from one, so data must outlive it
+    void serialize(std::vector<uint8_t>& data) const;
+    bool adopt(const uint8_t* data, size_t size);
+
+    // Key for up to (word_length * 3) Z-characters, padded with 5s and truncated like the dictionary entries
+    uint64_t make_key(const uint8_t* zchars, size_t count) const;
+
+    // Address of the entry matching key, 0 if the word isn't in the dictionary
+    uint16_t find(uint64_t key) const;
+
+    CharClass char_class(uint8_t zscii) const { return _char_class[zscii]; }
+    const std::vector<uint8_t>& separators() const { return _separators; }
+
+    uint32_t addr() const { return _addr; }
+    uint32_t end() const { return _end; }
+
+private:
+    struct Slot
+    {
+        uint64_t key;   // 0 marks an empty slot, real keys always have the end-of-text bit set
+        uint16_t addr;
+    };
+
+    struct ImageHeader
+    {
+        uint32_t slot_count;
+        uint32_t addr;
+        uint32_t end;
+        uint8_t shift;
+        uint8_t word_length;
+        uint8_t separator_count;
+        uint8_t reserved;
+    };
+
+    std::vector<Slot> _slots;
+    const Slot* _mapped_slots = nullptr;    // Slots in a story image, used instead of _slots
+    size_t _slot_count = 0;
+    uint8_t _shift = 64;
+    uint8_t _word_length = 0;
+    CharClass _char_class[256]{};
+    std::vector<uint8_t> _separators;
+    uint32_t _addr = 0;
+    uint32_t _end = 0;
+
+    size_t slot_for(uint64_t key) const { return (size_t)((key * 0x9E3779B97F4A7C15ull) >> _shift); }
+    const Slot* slots() const { return _mapped_slots ? _mapped_slots : _slots.data(); }
+};
@@ -1,8 +1,13 @@
 #include "gli_file.h"
 
+#include "blorb.h"
 #include "log.h"
+#include "mapped_file.h"
 #include "zlib/zlib.h"
-#include "zlib/contrib/minizip/unzip.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 
 bool GliFileContainer::open(const char* path, GliFile*& handle)
 {
@@ -21,10 +26,10 @@ bool GliFileContainer::open(const char* path, GliFile*& handle)
 
 void GliFileContainer::close(GliFile* handle)
 {
+    // The GliFile itself belongs to the caller, which deletes it
     if (handle)
     {
         close_internal(handle->_handle);
-        delete handle;
     }
 }
 
@@ -35,15 +40,41 @@ bool GliFileContainer::valid(GliFile* handle)
 }
 
 
-bool GliFileContainer::read_entire_file(const char* path, std::vector<uint8_t>& contents)
+uint64_t GliFileContainer::size(GliFile* handle)
+{
+    return size_internal(handle->_handle);
+}
+
+
+size_t GliFileContainer::read(GliFile* handle, uint64_t offset, void* buffer, size_t size)
+{
+    return read_internal(handle->_handle, offset, buffer, size);
+}
+
+
+const uint8_t* GliFileContainer::map(GliFile* handle)
+{
+    return map_internal(handle->_handle);
+}
+
+
+bool GliFileContainer::read_entire_file(const char* path, std::vector<uint8_t>& contents, bool* decompressed)
 {
-    return read_entire_file_internal(path, contents);
+    bool inflated = false;
+    bool success = read_entire_file_internal(path, contents, inflated);
+
+    if (decompressed)
+    {
+        *decompressed = inflated;
+    }
+
+    return success;
 }
 
 
 GliFile::GliFile(GliFileContainer* container, void* handle)
     : _container(container)
-    , _handle()
+    , _handle(handle)
 {
 }
 
@@ -67,156 +98,621 @@ void GliFile::close()
         _container->close(this);
         _container = nullptr;
         _handle = nullptr;
+        _position = 0;
     }
 }
 
 
-// TODO: File container representing the OS file system (or part thereof)
+uint64_t GliFile::size()
+{
+    return _container ? _container->size(this) : 0;
+}
+
+
+bool GliFile::seek(uint64_t position)
+{
+    if (!_container || position > size())
+    {
+        return false;
+    }
+
+    _position = position;
+    return true;
+}
+
+
+size_t GliFile::read(void* buffer, size_t size)
+{
+    if (!_container)
+    {
+        return 0;
+    }
+
+    size_t count = _container->read(this, _position, buffer, size);
+    _position += count;
+    return count;
+}
+
+
+const uint8_t* GliFile::map()
+{
+    return _container ? _container->map(this) : nullptr;
+}
+
+
+// File container representing the OS file system, or the part of it under a directory. Files are memory mapped, so
+// reading one is a copy out of the OS file cache rather than a series of reads.
 class GliFileContainerSystem : public GliFileContainer
 {
 public:
-    bool attach(const char* container_name) override { return true; }
+    bool attach(const char* container_name) override
+    {
+        // An empty name is the whole file system, paths are then used as they are
+        _root = container_name;
+
+        if (!_root.empty() && _root.back() != '/' && _root.back() != '\\')
+        {
+            _root.push_back('/');
+        }
+
+        return true;
+    }
+
+
     void dettach() override {}
-    bool open_internal(const char* path, void*& handle) override { return false; }
-    void close_internal(void* handle) override {}
-    bool valid_internal(void* handle) override { return false; }
-    bool read_entire_file_internal(const char* path, std::vector<uint8_t>& contents) override { return false; }
+
+
+    bool open_internal(const char* path, void*& handle) override
+    {
+        std::unique_ptr<MappedFile> file = std::make_unique<MappedFile>();
+
+        if (!file->open((_root + path).c_str(), false))
+        {
+            logf("GliFileContainerSystem::open_internal: Failed to map '%s'.\n", path);
+            return false;
+        }
+
+        handle = file.release();
+        return true;
+    }
+
+
+    void close_internal(void* handle) override
+    {
+        delete (MappedFile*)handle;
+    }
+
+
+    bool valid_internal(void* handle) override { return handle && ((MappedFile*)handle)->data(); }
+
+
+    uint64_t size_internal(void* handle) override { return ((MappedFile*)handle)->size(); }
+
+
+    size_t read_internal(void* handle, uint64_t offset, void* buffer, size_t size) override
+    {
+        MappedFile* file = (MappedFile*)handle;
+
+        if (offset >= file->size())
+        {
+            return 0;
+        }
+
+        size_t count = (size_t)std::min<uint64_t>(size, file->size() - offset);
+        memcpy(buffer, file->data() + offset, count);
+        return count;
+    }
+
+
+    const uint8_t* map_internal(void* handle) override { return ((MappedFile*)handle)->data(); }
+
+
+    bool read_entire_file_internal(const char* path, std::vector<uint8_t>& contents, bool& decompressed) override
+    {
+        MappedFile file;
+        decompressed = false;
+
+        if (!file.open((_root + path).c_str(), false))
+        {
+            logf("GliFileContainerSystem::read_entire_file_internal: Failed to map '%s'.\n", path);
+            return false;
+        }
+
+        contents.assign(file.data(), file.data() + file.size());
+        return true;
+    }
+
+private:
+    std::string _root;
 };
 
 
+// Zip archive container. The archive is memory mapped and its central directory indexed when attached, so opening a
+// file is a hash lookup and reads don't share any state: any number of threads can inflate entries at once.
 class GliFileContainerZipFile : public GliFileContainer
 {
 public:
     bool attach(const char* container_name) override
     {
         _container_name = container_name;
-        _unzfile = unzOpen(container_name);
-        _file_opened = false;
-        return !!_unzfile;
+        _entries.clear();
+
+        if (!_archive.open(container_name, false))
+        {
+            logf("GliFileContainerZipFile::attach: Failed to map '%s'.\n", container_name);
+            return false;
+        }
+
+        if (!read_central_directory())
+        {
+            logf("GliFileContainerZipFile::attach: '%s' is not a supported zip file.\n", container_name);
+            _archive.close();
+            _entries.clear();
+            return false;
+        }
+
+        return true;
     }
 
 
     void dettach() override
     {
-        if (_unzfile)
+        if (_archive.data())
         {
             logm("Dettaching zip file container.\n");
-
-            if (_file_opened)
-            {
-                unzCloseCurrentFile(_unzfile);
-            }
-
-            unzClose(_unzfile);
+            _archive.close();
+            _entries.clear();
         }
     }
 
 
     bool open_internal(const char* path, void*& handle) override
     {
-        if (!_unzfile)
+        const Entry* entry = find_entry(path);
+
+        if (!entry)
         {
-            logm("GliFileContainerZipFile::open_internal: Not attached.\n");
             return false;
         }
 
-        if (_file_opened)
+        if (entry->method != 0 && entry->method != 8)
         {
-            logm("GliFileContainerZipFile::open_internal: Only one file may be opened at a time.\n");
+            logf("GliFileContainerZipFile: '%s' uses unsupported compression method %u.\n", path, entry->method);
             return false;
         }
 
-        if (unzLocateFile(_unzfile, path, 1))
+        OpenFile* file = new OpenFile{ entry };
+
+        if (entry->method == 8 && inflateInit2(&file->stream, -MAX_WBITS) != Z_OK)
+        {
+            logf("GliFileContainerZipFile: Failed to start inflating '%s'.\n", path);
+            delete file;
+            return false;
+        }
+
+        file->stream.next_in = (Bytef*)(_archive.data() + entry->data_offset);
+        file->stream.avail_in = entry->compressed_size;
+        handle = file;
+        return true;
+    }
+
+
+    void close_internal(void* handle) override
+    {
+        OpenFile* file = (OpenFile*)handle;
+
+        if (file && file->entry->method == 8)
+        {
+            inflateEnd(&file->stream);
+        }
+
+        delete file;
+    }
+
+
+    bool valid_internal(void* handle) override { return handle && _archive.data(); }
+
+
+    uint64_t size_internal(void* handle) override { return ((OpenFile*)handle)->entry->uncompressed_size; }
+
+
+    size_t read_internal(void* handle, uint64_t offset, void* buffer, size_t size) override
+    {
+        OpenFile* file = (OpenFile*)handle;
+        const Entry& entry = *file->entry;
+
+        if (offset >= entry.uncompressed_size)
+        {
+            return 0;
+        }
+
+        size = (size_t)std::min<uint64_t>(size, entry.uncompressed_size - offset);
+
+        if (entry.method == 0)
+        {
+            memcpy(buffer, _archive.data() + entry.data_offset + offset, size);
+            return size;
+        }
+
+        // Deflate streams only go forwards, so going back restarts from the beginning of the entry
+        if (offset < file->stream.total_out)
+        {
+            inflateReset(&file->stream);
+            file->stream.next_in = (Bytef*)(_archive.data() + entry.data_offset);
+            file->stream.avail_in = entry.compressed_size;
+        }
+
+        // Skip forward through a small scratch window, zlib keeps its own 32K history
+        uint8_t scratch[4096];
+
+        while (file->stream.total_out < offset)
+        {
+            size_t skip = (size_t)std::min<uint64_t>(sizeof(scratch), offset - file->stream.total_out);
+
+            if (!inflate_into(*file, scratch, skip))
+            {
+                return 0;
+            }
+        }
+
+        return inflate_into(*file, (uint8_t*)buffer, size) ? size : 0;
+    }
+
+
+    const uint8_t* map_internal(void* handle) override
+    {
+        const Entry& entry = *((OpenFile*)handle)->entry;
+        return entry.method == 0 ? _archive.data() + entry.data_offset : nullptr;
+    }
+
+
+    bool read_entire_file_internal(const char* path, std::vector<uint8_t>& contents, bool& decompressed) override
+    {
+        const Entry* entry = find_entry(path);
+        decompressed = entry && entry->method != 0;
+        return entry && read_entry(*entry, contents);
+    }
+
+private:
+    struct Entry
+    {
+        std::string name;
+        uint64_t data_offset;       // Offset of the file data, past the local header
+        uint32_t compressed_size;
+        uint32_t uncompressed_size;
+        uint32_t crc;
+        uint16_t method;
+    };
+
+    struct OpenFile
+    {
+        const Entry* entry;
+        z_stream stream;            // Position in the inflated data is stream.total_out
+    };
+
+    std::string _container_name;
+    MappedFile _archive;
+    std::unordered_map<std::string, Entry> _entries;
+
+    static uint16_t read16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+    static uint32_t read32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+
+    const Entry* find_entry(const char* path)
+    {
+        if (!_archive.data())
+        {
+            logm("GliFileContainerZipFile: Not attached.\n");
+            return nullptr;
+        }
+
+        std::unordered_map<std::string, Entry>::const_iterator it = _entries.find(path);
+
+        if (it == _entries.end())
+        {
+            logf("GliFileContainerZipFile: File '%s' not found.\n", path);
+            return nullptr;
+        }
+
+        return &it->second;
+    }
+
+
+    bool read_central_directory()
+    {
+        /*
+            The end of central directory record is at least 22 bytes and ends the file, followed only by a comment of
+            up to 64K. It gives the number of entries and the offset of the central directory, each central directory
+            entry gives an entry's sizes and the offset of its local header.
+        */
+        const uint8_t* data = _archive.data();
+        size_t size = _archive.size();
+        size_t eocd = SIZE_MAX;
+
+        if (size < 22)
         {
-            logf("GliFileContainerZipFile::open_internal: File '%s' not found.\n", path);
             return false;
         }
 
-        if (unzGetCurrentFileInfo(_unzfile, &_current_file_info, nullptr, 0, nullptr, 0, nullptr, 0))
+        size_t lowest = size > 22 + 0xFFFF ? size - 22 - 0xFFFF : 0;
+
+        for (size_t pos = size - 22 + 1; pos-- > lowest;)
         {
-            logf("GliFileContainerZipFile::open_internal: Error getting file info for file '%s' [%d].\n", path, UNZ_ERRNO);
+            if (read32(data + pos) == 0x06054b50)
+            {
+                eocd = pos;
+                break;
+            }
         }
 
-        if (unzOpenCurrentFile(_unzfile))
+        if (eocd == SIZE_MAX)
         {
-            logf("GliFileContainerZipFile::open_internal: Error opening '%s' [%d].\n", path, UNZ_ERRNO);
             return false;
         }
 
-        _file_opened = true;
+        uint16_t num_entries = read16(data + eocd + 10);
+        uint32_t directory_offset = read32(data + eocd + 16);
+
+        if (num_entries == 0xFFFF || directory_offset == 0xFFFFFFFF)
+        {
+            logm("GliFileContainerZipFile: Zip64 archives are not supported.\n");
+            return false;
+        }
+
+        _entries.reserve(num_entries);
+        size_t pos = directory_offset;
+
+        for (uint16_t i = 0; i < num_entries; ++i)
+        {
+            if (pos + 46 > size || read32(data + pos) != 0x02014b50)
+            {
+                return false;
+            }
+
+            uint16_t name_length = read16(data + pos + 28);
+            size_t header_offset = read32(data + pos + 42);
+
+            if (pos + 46 + name_length > size || header_offset + 30 > size || read32(data + header_offset) != 0x04034b50)
+            {
+                return false;
+            }
+
+            // The local header's name and extra field lengths can differ from the central directory's
+            Entry entry;
+            entry.name.assign((const char*)data + pos + 46, name_length);
+            entry.method = read16(data + pos + 10);
+            entry.crc = read32(data + pos + 16);
+            entry.compressed_size = read32(data + pos + 20);
+            entry.uncompressed_size = read32(data + pos + 24);
+            entry.data_offset = header_offset + 30 + read16(data + header_offset + 26) + read16(data + header_offset + 28);
+
+            // Stored entries are read and mapped by their uncompressed size, so it has to be the size in the archive
+            if (entry.data_offset + entry.compressed_size > size ||
+                (entry.method == 0 && entry.compressed_size != entry.uncompressed_size))
+            {
+                return false;
+            }
+
+            std::string name = entry.name;
+            _entries.emplace(std::move(name), std::move(entry));
+            pos += 46 + name_length + read16(data + pos + 30) + read16(data + pos + 32);
+        }
 
         return true;
     }
 
 
-    void close_internal(void* handle) override
+    bool inflate_into(OpenFile& file, uint8_t* buffer, size_t size)
     {
-        if (_unzfile && _file_opened)
+        file.stream.next_out = buffer;
+        file.stream.avail_out = (uInt)size;
+
+        while (file.stream.avail_out)
         {
-            unzCloseCurrentFile(_unzfile);
-            _file_opened = false;
+            int result = inflate(&file.stream, Z_NO_FLUSH);
+
+            if (result != Z_OK && !(result == Z_STREAM_END && file.stream.avail_out == 0))
+            {
+                logf("GliFileContainerZipFile: Error inflating '%s' [%d].\n", file.entry->name.c_str(), result);
+                return false;
+            }
         }
+
+        return true;
     }
 
 
-    bool valid_internal(void* handle) override { return _unzfile && _file_opened; }
+    bool read_entry(const Entry& entry, std::vector<uint8_t>& contents)
+    {
+        const uint8_t* compressed = _archive.data() + entry.data_offset;
+        contents.resize(entry.uncompressed_size);
 
+        if (entry.method == 0)
+        {
+            if (entry.compressed_size != entry.uncompressed_size)
+            {
+                logf("GliFileContainerZipFile: Stored file '%s' has mismatched sizes.\n", entry.name.c_str());
+                return false;
+            }
 
-    bool read_entire_file_internal(const char* path, std::vector<uint8_t>& contents) override
-    {
-        if (!_unzfile)
+            memcpy(contents.data(), compressed, entry.compressed_size);
+        }
+        else if (entry.method == 8)
         {
-            logm("GliFileContainerZipFile::read_entire_file_internal: Not attached.\n");
+            // Raw deflate stream, one inflate call as the output size is known
+            z_stream stream{};
+
+            if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+            {
+                logf("GliFileContainerZipFile: Failed to start inflating '%s'.\n", entry.name.c_str());
+                return false;
+            }
+
+            stream.next_in = (Bytef*)compressed;
+            stream.avail_in = entry.compressed_size;
+            stream.next_out = contents.data();
+            stream.avail_out = entry.uncompressed_size;
+            int result = inflate(&stream, Z_FINISH);
+            inflateEnd(&stream);
+
+            if (result != Z_STREAM_END || stream.total_out != entry.uncompressed_size)
+            {
+                logf("GliFileContainerZipFile: Error inflating '%s' [%d].\n", entry.name.c_str(), result);
+                return false;
+            }
+        }
+        else
+        {
+            logf("GliFileContainerZipFile: '%s' uses unsupported compression method %u.\n", entry.name.c_str(), entry.method);
             return false;
         }
 
-        if (_file_opened)
+        if (crc32(0, contents.data(), entry.uncompressed_size) != entry.crc)
+        {
+            logf("GliFileContainerZipFile: CRC mismatch reading '%s'.\n", entry.name.c_str());
+            return false;
+        }
+
+        return true;
+    }
+};
+
+
+// Blorb container. The file is memory mapped and its resource index read when attached; files are resources named by
+// usage and number ("Exec/0", "Pict/3", "Snd/1", "Data/2") and are slices of the mapping, so they are never copied.
+class GliFileContainerBlorb : public GliFileContainer
+{
+public:
+    bool attach(const char* container_name) override
+    {
+        if (!_file.open(container_name, false))
         {
-            logm("GliFileContainerZipFile::read_entire_file_internal: Only one file may be opened at a time.\n");
+            logf("GliFileContainerBlorb::attach: Failed to map '%s'.\n", container_name);
             return false;
         }
 
-        if (unzLocateFile(_unzfile, path, 1))
+        if (!_index.parse(_file.data(), _file.size()))
         {
-            logf("GliFileContainerZipFile::read_entire_file_internal: File '%s' not found.\n", path);
+            logf("GliFileContainerBlorb::attach: '%s' is not a Blorb file.\n", container_name);
+            _file.close();
             return false;
         }
 
-        if (unzGetCurrentFileInfo(_unzfile, &_current_file_info, nullptr, 0, nullptr, 0, nullptr, 0))
+        return true;
+    }
+
+
+    void dettach() override
+    {
+        if (_file.data())
         {
-            logf("GliFileContainerZipFile::read_entire_file_internal: Error getting file info for file '%s' [%d].\n", path, UNZ_ERRNO);
+            logm("Dettaching Blorb container.\n");
+            _file.close();
+            _index = BlorbIndex();
         }
+    }
+
+
+    bool open_internal(const char* path, void*& handle) override
+    {
+        const BlorbIndex::Resource* resource = find_resource(path);
 
-        if (unzOpenCurrentFile(_unzfile))
+        if (!resource)
         {
-            logf("GliFileContainerZipFile::read_entire_file_internal: Error opening '%s' [%d].\n", path, UNZ_ERRNO);
             return false;
         }
 
-        contents.resize(_current_file_info.uncompressed_size);
-        int read_result = unzReadCurrentFile(_unzfile, contents.data(), _current_file_info.uncompressed_size);
+        // Resources have no state of their own, the GliFile keeps the position
+        handle = (void*)resource;
+        return true;
+    }
+
+
+    void close_internal(void* handle) override {}
+
+
+    bool valid_internal(void* handle) override { return handle && _file.data(); }
+
+
+    uint64_t size_internal(void* handle) override { return ((const BlorbIndex::Resource*)handle)->size; }
+
+
+    size_t read_internal(void* handle, uint64_t offset, void* buffer, size_t size) override
+    {
+        const BlorbIndex::Resource* resource = (const BlorbIndex::Resource*)handle;
+
+        if (offset >= resource->size)
+        {
+            return 0;
+        }
+
+        size_t count = (size_t)std::min<uint64_t>(size, resource->size - offset);
+        memcpy(buffer, _file.data() + resource->offset + offset, count);
+        return count;
+    }
+
 
-        unzCloseCurrentFile(_unzfile);
+    const uint8_t* map_internal(void* handle) override { return _file.data() + ((const BlorbIndex::Resource*)handle)->offset; }
 
-        // FIXME: unzReadCurrentFile's return result is ambiguous if the high bit of read size is set (unzReadCurrentFile returns either the number
-        // of bytes read or a negative number if an error occurred, but the requested read size is unsigned).
-        if ((uLong)read_result != _current_file_info.uncompressed_size)
+
+    bool read_entire_file_internal(const char* path, std::vector<uint8_t>& contents, bool& decompressed) override
+    {
+        const BlorbIndex::Resource* resource = find_resource(path);
+        decompressed = false;
+
+        if (!resource)
         {
-            logf("GliFileContainerZipFile::read_entire_file_internal: Error reading file '%s' [%d].\n", path, UNZ_ERRNO);
             return false;
         }
 
+        contents.assign(_file.data() + resource->offset, _file.data() + resource->offset + resource->size);
         return true;
     }
 
 private:
-    std::string _container_name;
-    unzFile _unzfile = nullptr;
-    bool _file_opened = false;
-    unz_file_info _current_file_info;
+    MappedFile _file;
+    BlorbIndex _index;
+
+
+    const BlorbIndex::Resource* find_resource(const char* path)
+    {
+        if (!_file.data())
+        {
+            logm("GliFileContainerBlorb: Not attached.\n");
+            return nullptr;
+        }
+
+        // Usage names shorter than four characters ("Snd") are padded with spaces in the file
+        const char* separator = strchr(path, '/');
+        char* end = nullptr;
+        uint32_t number = separator ? (uint32_t)strtoul(separator + 1, &end, 10) : 0;
+
+        if (!separator || separator == path || separator - path > 4 || end == separator + 1 || *end)
+        {
+            logf("GliFileContainerBlorb: '%s' is not a resource name.\n", path);
+            return nullptr;
+        }
+
+        char usage[5] = "    ";
+        memcpy(usage, path, separator - path);
+        const BlorbIndex::Resource* resource = _index.find(blorb_id(usage), number);
+
+        if (!resource)
+        {
+            logf("GliFileContainerBlorb: Resource '%s' not found.\n", path);
+        }
+
+        return resource;
+    }
 };
 
 
+static bool is_blorb_extension(const char* ext)
+{
+    return strcmp(ext, ".zblorb") == 0 || strcmp(ext, ".zlb") == 0 || strcmp(ext, ".blorb") == 0 || strcmp(ext, ".blb") == 0;
+}
+
+
 GliFileSystem::~GliFileSystem()
 {
     shutdown();
@@ -229,6 +725,15 @@ void GliFileSystem::shutdown()
     {
         container->dettach();
     }
+
+    _containers.clear();
+    _container_lookup.clear();
+
+    std::lock_guard<std::mutex> lock(_cache_mutex);
+    _cache.clear();
+    _cache_lookup.clear();
+    _cache_stats.bytes = 0;
+    _cache_stats.entries = 0;
 }
 
 
@@ -256,6 +761,10 @@ bool GliFileSystem::open(const char* path, GliFile*& handle)
         container = get_or_create_container(container_name);
         spath = spath.substr(delim + 2);
     }
+    else
+    {
+        container = get_or_create_container(std::string());
+    }
 
     if (container)
     {
@@ -271,6 +780,120 @@ bool GliFileSystem::open(const char* path, GliFile*& handle)
 
 
 bool GliFileSystem::read_entire_file(const char* path, std::vector<uint8_t>& contents)
+{
+    // The caller gets a copy either way, so caching it here would only cost a second one
+    if (SharedContents cached = find_cached(path))
+    {
+        contents.assign(cached->begin(), cached->end());
+        return true;
+    }
+
+    return read_uncached(path, contents);
+}
+
+
+bool GliFileSystem::read_shared(const char* path, SharedContents& contents)
+{
+    contents = find_cached(path);
+
+    if (contents)
+    {
+        return true;
+    }
+
+    std::vector<uint8_t> data;
+    bool decompressed = false;
+
+    if (!read_uncached(path, data, &decompressed))
+    {
+        return false;
+    }
+
+    contents = std::make_shared<const std::vector<uint8_t>>(std::move(data));
+
+    // Files copied from a mapping are cheaper to copy again than to keep. If another thread inflated the same file
+    // meanwhile its buffer wins, so everyone shares one copy.
+    if (decompressed)
+    {
+        contents = add_cached(path, std::move(contents));
+    }
+
+    return true;
+}
+
+
+void GliFileSystem::set_cache_budget(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(_cache_mutex);
+    _cache_budget = bytes;
+    trim_cache();
+}
+
+
+GliFileSystem::CacheStats GliFileSystem::cache_stats()
+{
+    std::lock_guard<std::mutex> lock(_cache_mutex);
+    return _cache_stats;
+}
+
+
+GliFileSystem::SharedContents GliFileSystem::find_cached(const char* path)
+{
+    std::lock_guard<std::mutex> lock(_cache_mutex);
+    CacheLookup::iterator it = _cache_lookup.find(path);
+
+    if (it == _cache_lookup.end())
+    {
+        _cache_stats.misses++;
+        return nullptr;
+    }
+
+    _cache_stats.hits++;
+    _cache.splice(_cache.begin(), _cache, it->second);
+    return it->second->contents;
+}
+
+
+GliFileSystem::SharedContents GliFileSystem::add_cached(const char* path, SharedContents contents)
+{
+    std::lock_guard<std::mutex> lock(_cache_mutex);
+    CacheLookup::iterator it = _cache_lookup.find(path);
+
+    if (it != _cache_lookup.end())
+    {
+        return it->second->contents;
+    }
+
+    if (contents->size() > _cache_budget)
+    {
+        return contents;
+    }
+
+    _cache.push_front(CacheEntry{ path, contents });
+    _cache_lookup.emplace(path, _cache.begin());
+    _cache_stats.bytes += contents->size();
+    _cache_stats.entries++;
+    trim_cache();
+    return contents;
+}
+
+
+void GliFileSystem::trim_cache()
+{
+    // Buffers still held by callers stay alive until released, they just stop counting against the budget
+    while (!_cache.empty() && _cache_stats.bytes > _cache_budget)
+    {
+        CacheEntry& oldest = _cache.back();
+        _cache_stats.bytes -= oldest.contents->size();
+        _cache_stats.entries--;
+        _cache_stats.evictions++;
+        _cache_lookup.erase(oldest.path);
+        _cache.pop_back();
+    }
+}
+
+
+bool GliFileSystem::read_uncached(const char* path, std::vector<uint8_t>& contents, bool* decompressed)
 {
     bool success = false;
     std::string spath(path);
@@ -282,7 +905,7 @@ bool GliFileSystem::read_entire_file(const char* path, std::vector<uint8_t>& con
 
         if (delim == std::string::npos)
         {
-            logf("GliFileSystem::read_entire_file: Couldn't parse path '%s'.\n", path);
+            logf("GliFileSystem::read_uncached: Couldn't parse path '%s'.\n", path);
             return false;
         }
 
@@ -290,14 +913,18 @@ bool GliFileSystem::read_entire_file(const char* path, std::vector<uint8_t>& con
         container = get_or_create_container(container_name);
         spath = spath.substr(delim + 2);
     }
+    else
+    {
+        container = get_or_create_container(std::string());
+    }
 
     if (container)
     {
-        success = container->read_entire_file(spath.c_str(), contents);
+        success = container->read_entire_file(spath.c_str(), contents, decompressed);
     }
     else
     {
-        logf("GliFileSystem::read_entire_file: could not find container to open file '%s'.\n", path);
+        logf("GliFileSystem::read_uncached: could not find container to open file '%s'.\n", path);
     }
 
     return success;
@@ -306,6 +933,9 @@ bool GliFileSystem::read_entire_file(const char* path, std::vector<uint8_t>& con
 
 GliFileContainer* GliFileSystem::get_or_create_container(const std::string& container_name)
 {
+    // Zip and Blorb files are containers of their own, anything else (including the empty name used for plain paths) is a
+    // directory in the OS file system. Containers are safe to use from any thread once created.
+    std::lock_guard<std::mutex> lock(_mutex);
     GliFileContainerLookup::const_iterator it = _container_lookup.find(container_name);
 
     if (it == _container_lookup.end())
@@ -313,31 +943,38 @@ GliFileContainer* GliFileSystem::get_or_create_container(const std::string& cont
         GliFileContainerPtr new_container;
         size_t ext = container_name.rfind('.');
 
-        if (ext != std::string::npos)
+        if (ext != std::string::npos && container_name.compare(ext, std::string::npos, ".zip") == 0)
         {
-            if (container_name.compare(ext, 3, ".zip"))
-            {
-                logf("GliFileSystem::get_or_create: Creating zip file container for '%s'\n", container_name.c_str());
-                new_container = std::make_unique<GliFileContainerZipFile>();
-
-                if (!new_container->attach(container_name.c_str()))
-                {
-                    logf("GliFileSystem::get_or_create: Failed to attach zip file container for '%s'\n", container_name.c_str());
-                    return nullptr;
-                }
+            logf("GliFileSystem::get_or_create: Creating zip file container for '%s'\n", container_name.c_str());
+            new_container = std::make_unique<GliFileContainerZipFile>();
+        }
+        else if (ext != std::string::npos && is_blorb_extension(container_name.c_str() + ext))
+        {
+            logf("GliFileSystem::get_or_create: Creating Blorb container for '%s'\n", container_name.c_str());
+            new_container = std::make_unique<GliFileContainerBlorb>();
+        }
+        else
+        {
+            logf("GliFileSystem::get_or_create: Creating system container for '%s'\n", container_name.c_str());
+            new_container = std::make_unique<GliFileContainerSystem>();
+        }
 
-                auto result = _container_lookup.emplace(container_name, _containers.size());
+        if (!new_container->attach(container_name.c_str()))
+        {
+            logf("GliFileSystem::get_or_create: Failed to attach container for '%s'\n", container_name.c_str());
+            return nullptr;
+        }
 
-                if (!result.second)
-                {
-                    logf("GliFileSystem::get_or_create: Failed to insert container for '%s' into map\n", container_name.c_str());
-                    return nullptr;
-                }
+        auto result = _container_lookup.emplace(container_name, _containers.size());
 
-                _containers.push_back(std::move(new_container));
-                it = result.first;
-            }
+        if (!result.second)
+        {
+            logf("GliFileSystem::get_or_create: Failed to insert container for '%s' into map\n", container_name.c_str());
+            return nullptr;
         }
+
+        _containers.push_back(std::move(new_container));
+        it = result.first;
     }
 
     return _containers[it->second].get();
@@ -1,10 +1,17 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
 #include <unordered_map>
 #include <vector>
 #include <memory>
 
 
+// An open file, closed when deleted. Each file has its own read position; different files can be read from
+// different threads, a single file only from one at a time.
 class GliFile
 {
 public:
@@ -14,11 +21,23 @@ public:
     void close();
     bool valid();
 
+    uint64_t size();
+    uint64_t tell() const { return _position; }
+    bool seek(uint64_t position);
+
+    // Reads up to size bytes at the current position, returns the number read (0 at the end of the file or on error)
+    size_t read(void* buffer, size_t size);
+
+    // The whole contents if the container holds them in memory as they are (a file in the OS file system, an
+    // uncompressed zip entry or a Blorb resource), otherwise null and the file has to be read
+    const uint8_t* map();
+
 protected:
     friend class GliFileContainer;
 
     class GliFileContainer* _container;
     void* _handle;
+    uint64_t _position = 0;
 };
 
 
@@ -31,8 +50,12 @@ public:
     bool open(const char* path, GliFile*& handle);
     void close(GliFile* handle);
     bool valid(GliFile* handle);
-    
-    bool read_entire_file(const char* path, std::vector<uint8_t>& contents);
+    uint64_t size(GliFile* handle);
+    size_t read(GliFile* handle, uint64_t offset, void* buffer, size_t size);
+    const uint8_t* map(GliFile* handle);
+
+    // decompressed is set if the contents had to be inflated rather than copied from memory the container maps
+    bool read_entire_file(const char* path, std::vector<uint8_t>& contents, bool* decompressed = nullptr);
 
     virtual bool attach(const char* container_name) = 0;
     virtual void dettach() = 0;
@@ -41,13 +64,27 @@ protected:
     virtual bool open_internal(const char* path, void*& handle) = 0;
     virtual void close_internal(void* handle) = 0;
     virtual bool valid_internal(void* handle) = 0;
-    virtual bool read_entire_file_internal(const char* path, std::vector<uint8_t>& contents) = 0;
+    virtual uint64_t size_internal(void* handle) = 0;
+    virtual size_t read_internal(void* handle, uint64_t offset, void* buffer, size_t size) = 0;
+    virtual const uint8_t* map_internal(void* handle) = 0;
+    virtual bool read_entire_file_internal(const char* path, std::vector<uint8_t>& contents, bool& decompressed) = 0;
 };
 
 
 class GliFileSystem
 {
 public:
+    using SharedContents = std::shared_ptr<const std::vector<uint8_t>>;
+
+    struct CacheStats
+    {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        size_t bytes;       // Bytes currently held
+        size_t entries;
+    };
+
     ~GliFileSystem();
 
     void shutdown();
@@ -55,13 +92,40 @@ public:
     bool open(const char* path, GliFile*& handle);
     bool read_entire_file(const char* path, std::vector<uint8_t>& contents);
 
+    // Archive entries read_shared has to inflate are kept in a cache shared by every caller, least recently used first
+    // out once the budget is exceeded. read_shared hands out the cached buffer itself; read_entire_file copies a cached
+    // buffer when there is one but doesn't add to the cache.
+    bool read_shared(const char* path, SharedContents& contents);
+    void set_cache_budget(size_t bytes);
+    CacheStats cache_stats();
+
 private:
+    struct CacheEntry
+    {
+        std::string path;
+        SharedContents contents;
+    };
+
+    using CacheList = std::list<CacheEntry>;
+    using CacheLookup = std::unordered_map<std::string, CacheList::iterator>;
+
     using GliFileContainerPtr = std::unique_ptr<GliFileContainer>;
     using GliFileContainerList = std::vector<GliFileContainerPtr>;
     using GliFileContainerLookup = std::unordered_map<std::string, size_t>;
 
     GliFileContainerList _containers;
     GliFileContainerLookup _container_lookup;
+    std::mutex _mutex;
+
+    CacheList _cache;               // Most recently used first
+    CacheLookup _cache_lookup;
+    size_t _cache_budget = 64 * 1024 * 1024;
+    CacheStats _cache_stats{};
+    std::mutex _cache_mutex;
 
     GliFileContainer* get_or_create_container(const std::string& container_name);
+    bool read_uncached(const char* path, std::vector<uint8_t>& contents, bool* decompressed = nullptr);
+    SharedContents find_cached(const char* path);
+    SharedContents add_cached(const char* path, SharedContents contents);
+    void trim_cache();
 };
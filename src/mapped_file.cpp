@@ -0,0 +1,162 @@
+#include "mapped_file.h"
+
+#include "log.h"
+
+#include <cstring>
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+
+bool MappedFile::open(const char* path, bool copy_on_write)
+{
+    close();
+
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        logf("MappedFile::open: Failed to open '%s' (%u)\n", path, GetLastError());
+        return false;
+    }
+
+    _file = file;
+    LARGE_INTEGER size{};
+
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0 || (uint64_t)size.QuadPart > SIZE_MAX)
+    {
+        logf("MappedFile::open: '%s' is empty or too large\n", path);
+        close();
+        return false;
+    }
+
+    _mapping = CreateFileMappingA(file, nullptr, copy_on_write ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, nullptr);
+
+    if (!_mapping)
+    {
+        logf("MappedFile::open: Failed to create mapping for '%s' (%u)\n", path, GetLastError());
+        close();
+        return false;
+    }
+
+    _data = (uint8_t*)MapViewOfFile(_mapping, copy_on_write ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+
+    if (!_data)
+    {
+        logf("MappedFile::open: Failed to map view of '%s' (%u)\n", path, GetLastError());
+        close();
+        return false;
+    }
+
+    _size = (size_t)size.QuadPart;
+    return true;
+}
+
+
+bool MappedFile::create(const uint8_t* data, size_t size)
+{
+    close();
+
+    if (size == 0)
+    {
+        logm("MappedFile::create: Nothing to map\n");
+        return false;
+    }
+
+    _mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size, nullptr);
+
+    if (!_mapping)
+    {
+        logf("MappedFile::create: Failed to create mapping (%u)\n", GetLastError());
+        return false;
+    }
+
+    // Filled through a view of its own, so the copy on write view starts out sharing every page with later copies
+    uint8_t* view = (uint8_t*)MapViewOfFile(_mapping, FILE_MAP_WRITE, 0, 0, 0);
+
+    if (!view)
+    {
+        logf("MappedFile::create: Failed to map view (%u)\n", GetLastError());
+        close();
+        return false;
+    }
+
+    memcpy(view, data, size);
+    UnmapViewOfFile(view);
+    _data = (uint8_t*)MapViewOfFile(_mapping, FILE_MAP_COPY, 0, 0, 0);
+
+    if (!_data)
+    {
+        logf("MappedFile::create: Failed to map view (%u)\n", GetLastError());
+        close();
+        return false;
+    }
+
+    _size = size;
+    return true;
+}
+
+
+bool MappedFile::copy_view(const MappedFile& other)
+{
+    close();
+
+    if (!other._mapping)
+    {
+        logm("MappedFile::copy_view: Nothing mapped\n");
+        return false;
+    }
+
+    // The view only needs the mapping, which it gets its own handle to so either file can be closed first
+    HANDLE process = GetCurrentProcess();
+
+    if (!DuplicateHandle(process, other._mapping, process, &_mapping, 0, FALSE, DUPLICATE_SAME_ACCESS))
+    {
+        logf("MappedFile::copy_view: Failed to duplicate mapping (%u)\n", GetLastError());
+        _mapping = nullptr;
+        return false;
+    }
+
+    _data = (uint8_t*)MapViewOfFile(_mapping, FILE_MAP_COPY, 0, 0, 0);
+
+    if (!_data)
+    {
+        logf("MappedFile::copy_view: Failed to map view (%u)\n", GetLastError());
+        close();
+        return false;
+    }
+
+    _size = other._size;
+    return true;
+}
+
+
+void MappedFile::close()
+{
+    if (_data)
+    {
+        UnmapViewOfFile(_data);
+        _data = nullptr;
+    }
+
+    if (_mapping)
+    {
+        CloseHandle(_mapping);
+        _mapping = nullptr;
+    }
+
+    if (_file)
+    {
+        CloseHandle(_file);
+        _file = nullptr;
+    }
+
+    _size = 0;
+}
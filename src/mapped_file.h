@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+// A file mapped into memory. Pages are shared with the OS file cache and only read in when touched. With copy on
+// write the view is writable, and only the pages that are actually written get private copies.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const char* path, bool copy_on_write);
+
+    // A copy on write view of memory backed by the page file, holding a copy of data. Like a file it can be shared
+    // with copy_view.
+    bool create(const uint8_t* data, size_t size);
+
+    // A new copy on write view of the file another MappedFile has open. It starts out as the file is, without the
+    // other view's writes, and shares every page either view hasn't written to.
+    bool copy_view(const MappedFile& other);
+    void close();
+
+    uint8_t* data() const { return _data; }
+    size_t size() const { return _size; }
+
+private:
+    void* _file = nullptr;
+    void* _mapping = nullptr;
+    uint8_t* _data = nullptr;
+    size_t _size = 0;
+};
@@ -0,0 +1,43 @@
+#include "output.h"
+
+#include "log.h"
+
+
+FileSink::~FileSink()
+{
+    close();
+}
+
+
+bool FileSink::open(const char* path)
+{
+    close();
+    _file = fopen(path, "ab");
+
+    if (!_file)
+    {
+        logf("FileSink::open: Failed to open '%s'\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+
+void FileSink::close()
+{
+    if (_file)
+    {
+        fclose(_file);
+        _file = nullptr;
+    }
+}
+
+
+void FileSink::write(std::string_view text, TextStyle::Type style, uint8_t window)
+{
+    if (_file)
+    {
+        fwrite(text.data(), 1, text.size(), _file);
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string_view>
+
+
+namespace OutputStream
+{
+typedef uint8_t Type;
+
+enum Streams
+{
+    Screen = 1,
+    Transcript = 2,
+    Memory = 3,
+    CommandScript = 4,
+    Count
+};
+} // namespace OutputStream
+
+
+namespace TextStyle
+{
+typedef uint8_t Type;
+
+enum Bits
+{
+    Roman = 0x00,
+    ReverseVideo = 0x01,
+    Bold = 0x02,
+    Italic = 0x04,
+    FixedPitch = 0x08
+};
+} // namespace TextStyle
+
+
+// Receives text from one of the Z-machine's output streams as it is produced. Text is UTF-8 and is only valid for the
+// duration of the call; a sink that wants to keep it must copy it.
+class OutputSink
+{
+public:
+    virtual ~OutputSink() = default;
+
+    virtual void write(std::string_view text, TextStyle::Type style, uint8_t window) = 0;
+};
+
+
+// Appends output to a file, used for the transcript (stream 2) and command script (stream 4).
+class FileSink : public OutputSink
+{
+public:
+    ~FileSink();
+
+    bool open(const char* path);
+    void close();
+
+    void write(std::string_view text, TextStyle::Type style, uint8_t window) override;
+
+private:
+    FILE* _file = nullptr;
+};
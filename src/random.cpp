@@ -0,0 +1,106 @@
+#include "random.h"
+
+#include <random>
+
+
+static uint64_t splitmix64(uint64_t& x)
+{
+    uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+
+static uint64_t rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+
+void Random::randomize()
+{
+    uint64_t seed_value = 0;
+
+    if (_entropy_source)
+    {
+        seed_value = _entropy_source();
+    }
+    else
+    {
+        std::random_device device;
+        seed_value = ((uint64_t)device() << 32) | device();
+    }
+
+    seed(seed_value);
+    _state.mode = Mode::Random;
+}
+
+
+void Random::seed(uint64_t seed)
+{
+    // Expand the seed with splitmix64 as the xoshiro authors recommend, which can't produce the all zero state
+    for (uint64_t& s : _state.s)
+    {
+        s = splitmix64(seed);
+    }
+
+    _state.mode = Mode::Seeded;
+    _state.sequence_limit = 0;
+    _state.sequence_next = 0;
+}
+
+
+void Random::predictable(uint16_t limit)
+{
+    _state.mode = Mode::Predictable;
+    _state.sequence_limit = limit ? limit : 1;
+    _state.sequence_next = 1;
+}
+
+
+uint16_t Random::next(uint16_t range)
+{
+    if (_state.mode == Mode::Predictable)
+    {
+        uint16_t value = _state.sequence_next;
+        _state.sequence_next = (value >= _state.sequence_limit) ? 1 : value + 1;
+        return (uint16_t)((value - 1) % range) + 1;
+    }
+
+    // Lemire's multiply and shift, rejecting the few low products that would bias the result
+    uint32_t x = (uint32_t)(next64() >> 32);
+    uint64_t m = (uint64_t)x * range;
+    uint32_t low = (uint32_t)m;
+
+    if (low < range)
+    {
+        uint32_t threshold = (uint32_t)(0x100000000ull % range);
+
+        while (low < threshold)
+        {
+            x = (uint32_t)(next64() >> 32);
+            m = (uint64_t)x * range;
+            low = (uint32_t)m;
+        }
+    }
+
+    return (uint16_t)(m >> 32) + 1;
+}
+
+
+uint64_t Random::next64()
+{
+    uint64_t* s = _state.s;
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+
+    return result;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+
+// The machine's random number source (xoshiro256**). Supports the three modes the standard asks for: random
+// (seeded from the host's entropy source), seeded (repeatable sequence from a seed) and predictable (counts 1..S).
+// The whole state is a plain struct so snapshots, clones and replays can copy it exactly.
+class Random
+{
+public:
+    enum class Mode : uint8_t
+    {
+        Random,
+        Seeded,
+        Predictable
+    };
+
+    struct State
+    {
+        uint64_t s[4];
+        Mode mode;
+        uint16_t sequence_limit;    // Predictable mode counts 1..sequence_limit
+        uint16_t sequence_next;
+    };
+
+    using EntropySource = std::function<uint64_t()>;
+
+    Random() { randomize(); }
+
+    // Random mode, seeded from the entropy source
+    void randomize();
+
+    // Replaces std::random_device as the source of seeds for random mode, so sessions can be recorded and replayed.
+    // Null restores std::random_device.
+    void set_entropy_source(EntropySource source) { _entropy_source = std::move(source); }
+
+    // Seeded mode, the same seed always gives the same sequence
+    void seed(uint64_t seed);
+
+    // Predictable mode, returns 1, 2, .. limit and then starts again
+    void predictable(uint16_t limit);
+
+    // Uniformly distributed in 1..range, range must be at least 1
+    uint16_t next(uint16_t range);
+
+    const State& state() const { return _state; }
+    void set_state(const State& state) { _state = state; }
+
+private:
+    State _state{};
+    EntropySource _entropy_source;
+
+    uint64_t next64();
+};
@@ -0,0 +1,415 @@
+#include "replay.h"
+
+#include "alloc_counter.h"
+#include "log.h"
+#include "zlib/zlib.h"
+
+#include <cstring>
+#include <random>
+
+
+static constexpr char session_magic[4] = { 'Z', 'R', 'P', 'L' };
+static constexpr uint8_t session_version = 1;
+static constexpr size_t session_header_size = 13;
+
+#if defined(ZILG_COUNT_ALLOCATIONS)
+// Updates allowed to allocate while the machine's buffers grow to their working size
+static constexpr size_t allocation_warmup_updates = 4;
+#endif
+
+
+SessionRecorder::~SessionRecorder()
+{
+    stop();
+}
+
+
+bool SessionRecorder::start(ZMachine& zm, const char* path, OutputSink* screen)
+{
+    stop();
+    _file = fopen(path, "wb");
+
+    if (!_file)
+    {
+        logf("SessionRecorder::start: Failed to open '%s'\n", path);
+        return false;
+    }
+
+    _zm = &zm;
+    _screen = screen;
+    _last_event = std::chrono::steady_clock::now();
+    _checksum = 0;
+    _output = false;
+    _pending = false;
+
+    const ZMachineHeader& header = zm.header();
+    uint8_t version = session_version;
+    uint8_t release[2] = { hi(header.release_number), lo(header.release_number) };
+    write_bytes(session_magic, sizeof(session_magic));
+    write_bytes(&version, 1);
+    write_bytes(release, sizeof(release));
+    write_bytes(header.serial, sizeof(header.serial));
+
+    // Every seed the generator takes from entropy is logged, starting with a fresh one now
+    zm.random().set_entropy_source([this]() {
+        std::random_device device;
+        uint64_t seed = ((uint64_t)device() << 32) | device();
+
+        if (_file)
+        {
+            write_event(SessionEvent::Seed);
+
+            for (int i = 0; i < 8; ++i)
+            {
+                uint8_t byte = (uint8_t)(seed >> (i * 8));
+                write_bytes(&byte, 1);
+            }
+        }
+
+        return seed;
+    });
+
+    zm.random().randomize();
+    zm.set_output_sink(OutputStream::Screen, this);
+    return true;
+}
+
+
+void SessionRecorder::stop()
+{
+    if (_zm)
+    {
+        _zm->random().set_entropy_source(nullptr);
+        _zm->set_output_sink(OutputStream::Screen, _screen);
+        _zm = nullptr;
+    }
+
+    if (_file)
+    {
+        fclose(_file);
+        _file = nullptr;
+    }
+}
+
+
+void SessionRecorder::input(std::string_view line)
+{
+    write_event(SessionEvent::Line);
+    write_varint(line.size());
+    write_bytes(line.data(), line.size());
+    _zm->input(line);
+}
+
+
+void SessionRecorder::key(uint8_t zscii)
+{
+    write_event(SessionEvent::Key);
+    write_bytes(&zscii, 1);
+    _zm->key(zscii);
+}
+
+
+void SessionRecorder::timer_expired()
+{
+    write_event(SessionEvent::Timer);
+    _zm->timer_expired();
+}
+
+
+ZMachine::State SessionRecorder::update()
+{
+    _checksum = 0;
+    _output = false;
+    ZMachine::State state = _zm->update();
+
+    // Hosts update every frame, only updates that had something to do are worth logging
+    if (_pending || _output)
+    {
+        write_event(SessionEvent::Update);
+        uint8_t checksum[4] = { (uint8_t)_checksum, (uint8_t)(_checksum >> 8), (uint8_t)(_checksum >> 16), (uint8_t)(_checksum >> 24) };
+        write_bytes(checksum, sizeof(checksum));
+        _pending = false;
+    }
+
+    return state;
+}
+
+
+void SessionRecorder::write(std::string_view text, TextStyle::Type style, uint8_t window)
+{
+    _checksum = crc32(_checksum, (const Bytef*)text.data(), (uInt)text.size());
+    _output = true;
+
+    if (_screen)
+    {
+        _screen->write(text, style, window);
+    }
+}
+
+
+void SessionRecorder::write_event(SessionEvent::Type type)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    uint64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - _last_event).count();
+    _last_event = now;
+    _pending = type != SessionEvent::Update;
+
+    write_bytes(&type, 1);
+    write_varint(elapsed);
+}
+
+
+void SessionRecorder::write_varint(uint64_t value)
+{
+    uint8_t bytes[10];
+    size_t count = 0;
+
+    do
+    {
+        bytes[count++] = (uint8_t)((value & 0x7F) | (value > 0x7F ? 0x80 : 0));
+        value >>= 7;
+    } while (value);
+
+    write_bytes(bytes, count);
+}
+
+
+void SessionRecorder::write_bytes(const void* data, size_t size)
+{
+    if (_file)
+    {
+        fwrite(data, 1, size, _file);
+    }
+}
+
+
+bool SessionReplayer::load(const char* path)
+{
+    _log.clear();
+    _seeds.clear();
+    FILE* file = fopen(path, "rb");
+
+    if (!file)
+    {
+        logf("SessionReplayer::load: Failed to open '%s'\n", path);
+        return false;
+    }
+
+    uint8_t buffer[4096];
+    size_t count = 0;
+
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        _log.insert(_log.end(), buffer, buffer + count);
+    }
+
+    fclose(file);
+
+    if (_log.size() < session_header_size || memcmp(_log.data(), session_magic, sizeof(session_magic)) != 0 ||
+        _log[4] != session_version)
+    {
+        logf("SessionReplayer::load: '%s' is not a session log\n", path);
+        _log.clear();
+        return false;
+    }
+
+    // Seeds are needed whenever the story asks for one, so collect them up front
+    if (!parse(false, nullptr))
+    {
+        _log.clear();
+        _seeds.clear();
+        return false;
+    }
+
+    return true;
+}
+
+
+bool SessionReplayer::run(ZMachine& zm)
+{
+    if (_log.size() < session_header_size)
+    {
+        logm("SessionReplayer::run: No session loaded\n");
+        return false;
+    }
+
+    const ZMachineHeader& header = zm.header();
+
+    if (make_word(_log[5], _log[6]) != header.release_number || memcmp(&_log[7], header.serial, sizeof(header.serial)) != 0)
+    {
+        logm("SessionReplayer::run: Session was recorded with a different story\n");
+        return false;
+    }
+
+    _next_seed = 0;
+    _updates = 0;
+
+    zm.random().set_entropy_source([this]() {
+        return (_next_seed < _seeds.size()) ? _seeds[_next_seed++] : 0;
+    });
+
+    zm.random().randomize();
+    zm.set_output_sink(OutputStream::Screen, this);
+    bool success = parse(true, &zm);
+    zm.set_output_sink(OutputStream::Screen, nullptr);
+    zm.random().set_entropy_source(nullptr);
+    return success;
+}
+
+
+void SessionReplayer::write(std::string_view text, TextStyle::Type style, uint8_t window)
+{
+    _checksum = crc32(_checksum, (const Bytef*)text.data(), (uInt)text.size());
+}
+
+
+bool SessionReplayer::parse(bool run, ZMachine* zm)
+{
+    // With run false only collects the seeds, otherwise feeds every event to the machine
+    const uint8_t* pos = _log.data() + session_header_size;
+    const uint8_t* end = _log.data() + _log.size();
+
+    auto read_varint = [&pos, end](uint64_t& value) {
+        value = 0;
+
+        for (int shift = 0; pos < end && shift < 64; shift += 7)
+        {
+            uint8_t byte = *pos++;
+            value |= (uint64_t)(byte & 0x7F) << shift;
+
+            if ((byte & 0x80) == 0)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    };
+
+    auto read_le = [&pos](size_t size) {
+        uint64_t value = 0;
+
+        for (size_t i = 0; i < size; ++i)
+        {
+            value |= (uint64_t)pos[i] << (i * 8);
+        }
+
+        pos += size;
+        return value;
+    };
+
+    while (pos < end)
+    {
+        SessionEvent::Type type = *pos++;
+        uint64_t elapsed = 0;
+        uint64_t length = 0;
+
+        if (!read_varint(elapsed))
+        {
+            logm("SessionReplayer: Truncated session log\n");
+            return false;
+        }
+
+        switch (type)
+        {
+            case SessionEvent::Line:
+                if (!read_varint(length) || length > (uint64_t)(end - pos))
+                {
+                    logm("SessionReplayer: Truncated session log\n");
+                    return false;
+                }
+
+                if (run)
+                {
+                    zm->input(std::string_view((const char*)pos, (size_t)length));
+                }
+
+                pos += length;
+                break;
+
+            case SessionEvent::Key:
+                if (pos + 1 > end)
+                {
+                    logm("SessionReplayer: Truncated session log\n");
+                    return false;
+                }
+
+                if (run)
+                {
+                    zm->key(*pos);
+                }
+
+                pos += 1;
+                break;
+
+            case SessionEvent::Timer:
+                if (run)
+                {
+                    zm->timer_expired();
+                }
+
+                break;
+
+            case SessionEvent::Seed:
+                if (pos + 8 > end)
+                {
+                    logm("SessionReplayer: Truncated session log\n");
+                    return false;
+                }
+
+                if (run)
+                {
+                    // Already queued for the entropy source
+                    pos += 8;
+                }
+                else
+                {
+                    _seeds.push_back(read_le(8));
+                }
+
+                break;
+
+            case SessionEvent::Update:
+                if (pos + 4 > end)
+                {
+                    logm("SessionReplayer: Truncated session log\n");
+                    return false;
+                }
+
+                if (run)
+                {
+                    uint32_t expected = (uint32_t)read_le(4);
+                    _checksum = 0;
+                    zm->update();
+                    ++_updates;
+
+                    if (_checksum != expected)
+                    {
+                        logf("SessionReplayer: Output of update %zu differs from the recording\n", _updates);
+                        return false;
+                    }
+
+#if defined(ZILG_COUNT_ALLOCATIONS)
+                    if (_updates > allocation_warmup_updates && zm->update_allocations() != 0)
+                    {
+                        logf("SessionReplayer: Update %zu made %llu heap allocations\n", _updates,
+                             (unsigned long long)zm->update_allocations());
+                        return false;
+                    }
+#endif
+                }
+                else
+                {
+                    pos += 4;
+                }
+
+                break;
+
+            default:
+                logf("SessionReplayer: Unknown event %u\n", type);
+                return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "output.h"
+#include "zmachine.h"
+
+
+/*
+    Session log file layout:
+    4 bytes     - "ZRPL"
+    1 byte      - format version
+    2 bytes     - story release number
+    6 bytes     - story serial
+    events
+
+    Each event is a type byte, the milliseconds since the previous event as a varint, then:
+    Line        - varint length, text
+    Key         - ZSCII code
+    Timer       - nothing
+    Seed        - 8 byte seed handed to the random number generator, little endian
+    Update      - 4 byte CRC-32 of the screen output produced by the update, little endian
+*/
+namespace SessionEvent
+{
+typedef uint8_t Type;
+
+enum Types
+{
+    Line = 1,
+    Key = 2,
+    Timer = 3,
+    Seed = 4,
+    Update = 5
+};
+} // namespace SessionEvent
+
+
+// Records the input, timer and random seed events of a session so it can be replayed exactly. The host calls the
+// recorder instead of the machine for these, and the recorder sits in front of the screen sink to checksum output.
+class SessionRecorder : public OutputSink
+{
+public:
+    ~SessionRecorder();
+
+    // Call after the story is loaded and before the first update. screen receives the output as before, it may be null.
+    bool start(ZMachine& zm, const char* path, OutputSink* screen);
+    void stop();
+
+    void input(std::string_view line);
+    void key(uint8_t zscii);
+    void timer_expired();
+    ZMachine::State update();
+
+    void write(std::string_view text, TextStyle::Type style, uint8_t window) override;
+
+private:
+    ZMachine* _zm = nullptr;
+    OutputSink* _screen = nullptr;
+    FILE* _file = nullptr;
+    std::chrono::steady_clock::time_point _last_event;
+    uint32_t _checksum{};
+    bool _output = false;
+    bool _pending = false;  // Events were written since the last update was logged
+
+    void write_event(SessionEvent::Type type);
+    void write_varint(uint64_t value);
+    void write_bytes(const void* data, size_t size);
+};
+
+
+// Plays a recorded session back against a freshly loaded machine at full speed with no host, checking the output of
+// each update against the recording.
+class SessionReplayer : public OutputSink
+{
+public:
+    bool load(const char* path);
+
+    // Returns false at the first update whose output differs from the recording. Built with ZILG_COUNT_ALLOCATIONS,
+    // also at the first update past the opening few that allocates.
+    bool run(ZMachine& zm);
+
+    // Updates replayed by the last run, including the one that diverged
+    size_t updates() const { return _updates; }
+
+    void write(std::string_view text, TextStyle::Type style, uint8_t window) override;
+
+private:
+    std::vector<uint8_t> _log;
+    std::vector<uint64_t> _seeds;
+    size_t _next_seed{};
+    size_t _updates{};
+    uint32_t _checksum{};
+
+    bool parse(bool run, ZMachine* zm);
+};
@@ -0,0 +1,137 @@
+#include "scrollback.h"
+
+#include "log.h"
+#include "zlib/zlib.h"
+
+#include <algorithm>
+
+
+ScrollbackStore::ScrollbackStore(size_t memory_budget, size_t block_size)
+    : _memory_budget(memory_budget)
+    , _block_size(block_size)
+{
+    // Room for a full block plus the lines written while it fills, so the buffer doesn't grow in steady state
+    _recent.reserve(block_size * 2);
+    _recent_ends.reserve(block_size / 16);
+}
+
+
+void ScrollbackStore::write(std::string_view text, TextStyle::Type style, uint8_t window)
+{
+    for (size_t start = 0; start < text.size();)
+    {
+        size_t newline = text.find('\n', start);
+
+        if (newline == std::string_view::npos)
+        {
+            _recent.append(text.data() + start, text.size() - start);
+            break;
+        }
+
+        _recent.append(text.data() + start, newline - start);
+        _recent_ends.push_back((uint32_t)_recent.size());
+        start = newline + 1;
+
+        if (_recent_ends.back() >= _block_size)
+        {
+            seal_block();
+        }
+    }
+}
+
+
+size_t ScrollbackStore::first_line() const
+{
+    return _blocks.empty() ? _recent_first_line : _blocks.front().first_line;
+}
+
+
+std::string_view ScrollbackStore::line(size_t index)
+{
+    if (index >= end_line() || index < first_line())
+    {
+        return std::string_view();
+    }
+
+    if (index >= _recent_first_line)
+    {
+        size_t i = index - _recent_first_line;
+        size_t start = i ? _recent_ends[i - 1] : 0;
+        size_t end = (i < _recent_ends.size()) ? _recent_ends[i] : _recent.size();
+        return std::string_view(_recent.data() + start, end - start);
+    }
+
+    // Blocks are in line order, find the last one starting at or before index
+    std::deque<Block>::const_iterator it = std::upper_bound(_blocks.cbegin(), _blocks.cend(), index,
+        [](size_t index, const Block& block) { return index < block.first_line; });
+    const Block& block = *(it - 1);
+
+    if (_cached_block != block.first_line)
+    {
+        uLongf size = block.size;
+        _cache.resize(block.size);
+
+        if (uncompress((Bytef*)&_cache[0], &size, block.data.data(), (uLong)block.data.size()) != Z_OK || size != block.size)
+        {
+            logf("ScrollbackStore::line: Failed to decompress block at line %zu\n", block.first_line);
+            _cached_block = SIZE_MAX;
+            return std::string_view();
+        }
+
+        _cached_block = block.first_line;
+    }
+
+    size_t i = index - block.first_line;
+    size_t start = i ? block.ends[i - 1] : 0;
+    return std::string_view(_cache.data() + start, block.ends[i] - start);
+}
+
+
+void ScrollbackStore::seal_block()
+{
+    // Move every complete line into a new compressed block, the partial line stays behind
+    Block block;
+    block.first_line = _recent_first_line;
+    block.size = _recent_ends.back();
+    block.ends = _recent_ends;
+
+    uLongf compressed_size = compressBound(block.size);
+    block.data.resize(compressed_size);
+
+    if (compress2(block.data.data(), &compressed_size, (const Bytef*)_recent.data(), block.size, Z_BEST_SPEED) != Z_OK)
+    {
+        // Lines have to stay contiguous, so everything older than the recent lines goes
+        logm("ScrollbackStore::seal_block: Failed to compress block, older lines discarded\n");
+        block.ends.clear();
+        _blocks.clear();
+        _block_bytes = 0;
+        _cached_block = SIZE_MAX;
+    }
+
+    block.data.resize(compressed_size);
+    block.data.shrink_to_fit();
+
+    _recent_first_line += _recent_ends.size();
+    _recent.erase(0, block.size);
+    _recent_ends.clear();
+
+    if (!block.ends.empty())
+    {
+        _block_bytes += block.data.size() + block.ends.size() * sizeof(uint32_t);
+        _blocks.push_back(std::move(block));
+    }
+
+    // Drop the oldest blocks to stay within budget, always keeping the recent lines
+    while (!_blocks.empty() && memory_used() > _memory_budget)
+    {
+        const Block& oldest = _blocks.front();
+        _block_bytes -= oldest.data.size() + oldest.ends.size() * sizeof(uint32_t);
+
+        if (_cached_block == oldest.first_line)
+        {
+            _cached_block = SIZE_MAX;
+        }
+
+        _blocks.pop_front();
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "output.h"
+
+
+// Line store for a scrolling window with a fixed memory budget. Recent lines are kept as plain text in one
+// contiguous buffer; once that fills up the oldest lines are moved into a zlib compressed block. When the blocks go
+// over budget the oldest are discarded, so first_line() moves forward over a long session.
+//
+// Lines are numbered from 0 for the first line ever written. The last line is the one currently being written to,
+// so while the machine waits for input it holds the prompt.
+class ScrollbackStore : public OutputSink
+{
+public:
+    ScrollbackStore(size_t memory_budget = 4 * 1024 * 1024, size_t block_size = 16 * 1024);
+
+    void write(std::string_view text, TextStyle::Type style, uint8_t window) override;
+
+    // Lines in [first_line(), end_line()) can be read
+    size_t first_line() const;
+    size_t end_line() const { return _recent_first_line + _recent_ends.size() + 1; }
+
+    // Text of a line without its line break. Only valid until the next call to line() or write().
+    std::string_view line(size_t index);
+
+    // Bytes held by compressed blocks and the recent line buffer
+    size_t memory_used() const { return _block_bytes + _recent.capacity() + _recent_ends.capacity() * sizeof(uint32_t); }
+
+private:
+    struct Block
+    {
+        size_t first_line;
+        uint32_t size;                  // Uncompressed size
+        std::vector<uint32_t> ends;     // End offset of each line in the uncompressed text
+        std::vector<uint8_t> data;
+    };
+
+    size_t _memory_budget;
+    size_t _block_size;
+
+    std::deque<Block> _blocks;
+    size_t _block_bytes{};
+
+    std::string _recent;
+    std::vector<uint32_t> _recent_ends; // End offset of each complete line in _recent
+    size_t _recent_first_line{};
+
+    size_t _cached_block = SIZE_MAX;    // First line of the block decompressed into _cache
+    std::string _cache;
+
+    void seal_block();
+};
@@ -0,0 +1,79 @@
+#include "session_template.h"
+
+#include "log.h"
+
+
+bool SessionTemplate::create(const char* path)
+{
+    _ready = false;
+    return _zm.load(path) && run_intro();
+}
+
+
+bool SessionTemplate::create(std::vector<uint8_t>&& story_file)
+{
+    _ready = false;
+    return _zm.load(std::move(story_file)) && run_intro();
+}
+
+
+bool SessionTemplate::start_session(ZMachine& zm, OutputSink* screen) const
+{
+    if (!_ready || !zm.clone(_zm))
+    {
+        logm("SessionTemplate::start_session: Failed to clone template\n");
+        return false;
+    }
+
+    // Sessions share the intro but not the random sequence after it, unless the story asked for a repeatable one
+    if (zm.random().state().mode == Random::Mode::Random)
+    {
+        zm.random().randomize();
+    }
+
+    zm.set_output_sink(OutputStream::Screen, screen);
+
+    if (screen)
+    {
+        size_t offset = 0;
+
+        for (const OutputRun& run : _runs)
+        {
+            screen->write(std::string_view(_intro).substr(offset, run.length), run.style, run.window);
+            offset += run.length;
+        }
+    }
+
+    return true;
+}
+
+
+void SessionTemplate::write(std::string_view text, TextStyle::Type style, uint8_t window)
+{
+    if (_runs.empty() || _runs.back().style != style || _runs.back().window != window)
+    {
+        _runs.push_back(OutputRun{ 0, style, window });
+    }
+
+    _runs.back().length += text.size();
+    _intro.append(text);
+}
+
+
+bool SessionTemplate::run_intro()
+{
+    _intro.clear();
+    _runs.clear();
+    _zm.set_output_sink(OutputStream::Screen, this);
+    ZMachine::State state = _zm.update();
+    _zm.set_output_sink(OutputStream::Screen, nullptr);
+
+    if (state != ZMachine::State::InputRequested)
+    {
+        logm("SessionTemplate::run_intro: Story didn't reach an input request\n");
+        return false;
+    }
+
+    _ready = true;
+    return true;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "output.h"
+#include "zmachine.h"
+
+
+// A story run once up to its first request for input. New sessions are cloned from the template instead of running
+// the story's intro themselves, and their screen is sent the intro's text as if they had printed it. Starting a session
+// only reads the template, so sessions can be started from any number of threads.
+class SessionTemplate : public OutputSink
+{
+public:
+    // Loads the story as ZMachine::load does and runs it to its first input request
+    bool create(const char* path);
+    bool create(std::vector<uint8_t>&& story_file);
+
+    // The session starts waiting for its first input. screen receives the intro and becomes the session's screen sink,
+    // it may be null.
+    bool start_session(ZMachine& zm, OutputSink* screen) const;
+
+    void write(std::string_view text, TextStyle::Type style, uint8_t window) override;
+
+private:
+    struct OutputRun
+    {
+        size_t length;
+        TextStyle::Type style;
+        uint8_t window;
+    };
+
+    ZMachine _zm;
+    std::string _intro;             // Screen output of the intro, split into runs by style and window
+    std::vector<OutputRun> _runs;
+    bool _ready = false;
+
+    bool run_intro();
+};
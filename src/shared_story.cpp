@@ -0,0 +1,177 @@
+#include "shared_story.h"
+
+#include "log.h"
+
+#include <cstring>
+
+
+std::shared_ptr<const SharedStory> SharedStory::create(const char* path)
+{
+    std::shared_ptr<SharedStory> story = std::make_shared<SharedStory>();
+
+    if (!story->_machine.load(path) || !story->share_tables())
+    {
+        return nullptr;
+    }
+
+    return story;
+}
+
+
+std::shared_ptr<const SharedStory> SharedStory::create(const std::vector<uint8_t>& story_file)
+{
+    std::shared_ptr<SharedStory> story = std::make_shared<SharedStory>();
+
+    if (!story->_machine.load_shareable(story_file) || !story->share_tables())
+    {
+        return nullptr;
+    }
+
+    return story;
+}
+
+
+StoryKey SharedStory::key() const
+{
+    return StoryKey(header().release_number, header().serial, header().file_checksum);
+}
+
+
+size_t SharedStory::resident_bytes() const
+{
+    return _machine.memory_size() + _image.size() + (_machine.initial_memory() ? _machine.initial_memory()->size() : 0);
+}
+
+
+bool SharedStory::share_tables()
+{
+    // Tables built by the machine live in its own vectors and would be copied into every session, so they're moved
+    // into an image that sessions point at instead. A story loaded from an image file goes the same way, which keeps
+    // sessions off the file's mapping. The machine already holds the story, so the image is only the tables.
+    if (!_machine.save_image(_image, false) || !_tables.open(_image.data(), _image.size()))
+    {
+        logm("SharedStory::share_tables: Failed to build the story's tables\n");
+        return false;
+    }
+
+    return _machine.use_image_tables(_tables);
+}
+
+
+std::shared_ptr<const SharedStory> StoryCatalog::find(const char* path)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        PathLookup::const_iterator known = _by_path.find(path);
+
+        if (known != _by_path.end())
+        {
+            KeyLookup::const_iterator it = _by_key.find(known->second);
+
+            if (it != _by_key.end())
+            {
+                _stats.hits++;
+                _stories.splice(_stories.begin(), _stories, it->second);
+                return it->second->story;
+            }
+        }
+
+        _stats.misses++;
+    }
+
+    // Loaded without the lock, so one slow story doesn't hold up sessions of the others
+    std::shared_ptr<const SharedStory> story = SharedStory::create(path);
+
+    if (!story)
+    {
+        return nullptr;
+    }
+
+    return add(path, std::move(story));
+}
+
+
+void StoryCatalog::set_memory_budget(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _memory_budget = bytes;
+    trim();
+}
+
+
+StoryCatalog::Stats StoryCatalog::stats()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+
+std::vector<StoryCatalog::StoryStats> StoryCatalog::story_stats()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<StoryStats> stories;
+    stories.reserve(_stories.size());
+
+    for (const Entry& entry : _stories)
+    {
+        const ZMachineHeader& header = entry.story->header();
+        StoryStats story{ entry.path, header.release_number, {}, header.file_checksum, entry.resident_bytes,
+                          entry.story.use_count() - 1 };
+        memcpy(story.serial, header.serial, sizeof(story.serial));
+        stories.push_back(story);
+    }
+
+    return stories;
+}
+
+
+std::shared_ptr<const SharedStory> StoryCatalog::add(const char* path, std::shared_ptr<const SharedStory> story)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    StoryKey key = story->key();
+    _by_path[path] = key;
+
+    // Another path to the same story, or another thread loading this one, got there first and everyone shares its copy
+    KeyLookup::const_iterator it = _by_key.find(key);
+
+    if (it != _by_key.end())
+    {
+        _stories.splice(_stories.begin(), _stories, it->second);
+        return it->second->story;
+    }
+
+    _stories.push_front(Entry{ key, path, story, story->resident_bytes() });
+    _by_key.emplace(key, _stories.begin());
+    _stats.bytes += _stories.front().resident_bytes;
+    _stats.stories++;
+    trim();
+    return story;
+}
+
+
+void StoryCatalog::trim()
+{
+    // The story just added is first in the list and is never evicted, even if it doesn't fit the budget on its own
+    EntryList::iterator it = _stories.end();
+
+    while (_stats.bytes > _memory_budget && it != _stories.begin())
+    {
+        --it;
+
+        if (it == _stories.begin() || it->story.use_count() > 1)
+        {
+            continue;
+        }
+
+        for (PathLookup::iterator path = _by_path.begin(); path != _by_path.end();)
+        {
+            path = path->second == it->key ? _by_path.erase(path) : std::next(path);
+        }
+
+        _stats.bytes -= it->resident_bytes;
+        _stats.stories--;
+        _stats.evictions++;
+        _by_key.erase(it->key);
+        it = _stories.erase(it);
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "story_image.h"
+#include "story_key.h"
+#include "zmachine.h"
+
+
+// A story loaded once for every session playing it. It holds the story's memory as loaded and the tables built for it,
+// kept as a story image in memory, and never runs. The story is always mapped, from its file or from memory backed by
+// the page file, so sessions started with ZMachine::load(story) get copy on write views that copy only what a session
+// writes to. They point at the tables, so a hundred sessions of one story share a single set.
+class SharedStory
+{
+public:
+    // Loads the story as ZMachine::load or load_shareable does and builds its shared tables. Null if the story can't be
+    // loaded.
+    static std::shared_ptr<const SharedStory> create(const char* path);
+    static std::shared_ptr<const SharedStory> create(const std::vector<uint8_t>& story_file);
+
+    StoryKey key() const;
+
+    const ZMachine& machine() const { return _machine; }
+    const ZMachineHeader& header() const { return _machine.header(); }
+
+    // Memory held for the story: its memory as loaded, the table image and the initial dynamic memory snapshots are
+    // encoded against. Pages of a mapped story that were never read in are counted too.
+    size_t resident_bytes() const;
+
+private:
+    ZMachine _machine;
+    std::vector<uint8_t> _image;
+    StoryImage _tables;
+
+    bool share_tables();
+};
+
+
+// Stories by release, serial and checksum, loaded on first use and kept while they fit the memory budget. Stories
+// with sessions still running can't be freed, so only those no session holds are evicted, least recently used first.
+class StoryCatalog
+{
+public:
+    struct Stats
+    {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        size_t bytes;       // Resident bytes of the stories held
+        size_t stories;
+    };
+
+    struct StoryStats
+    {
+        std::string path;   // Path the story was first loaded from
+        uint16_t release_number;
+        uint8_t serial[6];
+        uint16_t checksum;
+        size_t resident_bytes;
+        long sessions;      // Machines and other holders outside the catalog
+    };
+
+    // Null if the story can't be loaded. Paths to another copy of a story already in the catalog, such as a Blorb
+    // file and the story file inside it, load it only to find its key.
+    std::shared_ptr<const SharedStory> find(const char* path);
+
+    void set_memory_budget(size_t bytes);
+    Stats stats();
+    std::vector<StoryStats> story_stats();
+
+private:
+    struct Entry
+    {
+        StoryKey key;
+        std::string path;
+        std::shared_ptr<const SharedStory> story;
+        size_t resident_bytes;
+    };
+
+    using EntryList = std::list<Entry>;
+    using KeyLookup = std::unordered_map<StoryKey, EntryList::iterator, StoryKey::Hash>;
+    using PathLookup = std::unordered_map<std::string, StoryKey>;
+
+    EntryList _stories;             // Most recently used first
+    KeyLookup _by_key;
+    PathLookup _by_path;
+    size_t _memory_budget = 256 * 1024 * 1024;
+    Stats _stats{};
+    std::mutex _mutex;
+
+    std::shared_ptr<const SharedStory> add(const char* path, std::shared_ptr<const SharedStory> story);
+    void trim();
+};
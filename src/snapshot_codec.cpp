@@ -0,0 +1,261 @@
+#include "snapshot_codec.h"
+
+#include "log.h"
+#include "zlib/zlib.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+// Everything before the dynamic memory and the stack, see the layout in snapshot_codec.h
+static constexpr size_t snapshot_fixed_size = 106;
+
+
+static void put(std::vector<uint8_t>& data, uint64_t value, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; ++i)
+    {
+        data.push_back((uint8_t)(value >> (i * 8)));
+    }
+}
+
+
+// Reads little endian values, failing (and returning 0) from the first read past the end
+class SnapshotReader
+{
+public:
+    SnapshotReader(const uint8_t* data, size_t size) : _data(data), _end(data + size) {}
+
+    uint64_t get(size_t bytes)
+    {
+        uint64_t value = 0;
+
+        if ((size_t)(_end - _data) < bytes)
+        {
+            _ok = false;
+            _data = _end;
+            return 0;
+        }
+
+        for (size_t i = 0; i < bytes; ++i)
+        {
+            value |= (uint64_t)*_data++ << (i * 8);
+        }
+
+        return value;
+    }
+
+    const uint8_t* position() const { return _data; }
+    const uint8_t* end() const { return _end; }
+    bool ok() const { return _ok; }
+
+private:
+    const uint8_t* _data;
+    const uint8_t* _end;
+    bool _ok = true;
+};
+
+
+bool SnapshotCodec::encode(const ZMachine::Snapshot& snapshot, std::vector<uint8_t>& data)
+{
+    std::vector<uint8_t> raw;
+    raw.reserve(128 + snapshot.stack.size() * 2 + snapshot.memory_size / 8);
+
+    put(raw, snapshot.release_number, 2);
+    raw.insert(raw.end(), snapshot.serial, snapshot.serial + sizeof(snapshot.serial));
+    put(raw, snapshot.checksum, 2);
+    put(raw, snapshot.pc, 4);
+    put(raw, snapshot.sp, 2);
+    put(raw, snapshot.locals_base, 2);
+    put(raw, snapshot.instruction.opcode, 2);
+    put(raw, snapshot.instruction.operand_count, 1);
+    raw.insert(raw.end(), snapshot.instruction.operand_types, snapshot.instruction.operand_types + 8);
+
+    for (uint16_t operand : snapshot.instruction.operands)
+    {
+        put(raw, operand, 2);
+    }
+
+    put(raw, snapshot.input_timeout, 2);
+    put(raw, snapshot.input_routine, 2);
+    put(raw, snapshot.window, 1);
+    put(raw, snapshot.text_style, 1);
+
+    for (uint64_t s : snapshot.random.s)
+    {
+        put(raw, s, 8);
+    }
+
+    put(raw, (uint8_t)snapshot.random.mode, 1);
+    put(raw, snapshot.random.sequence_limit, 2);
+    put(raw, snapshot.random.sequence_next, 2);
+    put(raw, snapshot.memory_size, 4);
+    put(raw, snapshot.stack.size(), 4);
+
+    for (uint16_t word : snapshot.stack)
+    {
+        put(raw, word, 2);
+    }
+
+    // XOR-RLE against the story as loaded, so memory the story hasn't changed costs almost nothing
+    const std::vector<uint8_t>& initial = *snapshot.initial_memory;
+    uint32_t zeros = 0;
+
+    for (uint32_t addr = 0; addr < snapshot.memory_size; ++addr)
+    {
+        uint8_t byte = snapshot.pages[addr / ZMachine::snapshot_page_size]->bytes[addr % ZMachine::snapshot_page_size] ^ initial[addr];
+
+        if (byte == 0)
+        {
+            ++zeros;
+            continue;
+        }
+
+        for (; zeros; zeros -= std::min<uint32_t>(zeros, 256))
+        {
+            raw.push_back(0);
+            raw.push_back((uint8_t)(std::min<uint32_t>(zeros, 256) - 1));
+        }
+
+        raw.push_back(byte);
+    }
+
+    uLongf compressed_size = compressBound((uLong)raw.size());
+    data.resize(4 + compressed_size);
+    data[0] = (uint8_t)raw.size();
+    data[1] = (uint8_t)(raw.size() >> 8);
+    data[2] = (uint8_t)(raw.size() >> 16);
+    data[3] = (uint8_t)(raw.size() >> 24);
+
+    int result = compress2(data.data() + 4, &compressed_size, raw.data(), (uLong)raw.size(), Z_DEFAULT_COMPRESSION);
+
+    if (result != Z_OK)
+    {
+        logf("SnapshotCodec::encode: Compression failed [%d]\n", result);
+        return false;
+    }
+
+    data.resize(4 + compressed_size);
+    return true;
+}
+
+
+bool SnapshotCodec::decode(const uint8_t* data, size_t size, const std::shared_ptr<const std::vector<uint8_t>>& initial_memory,
+                           ZMachine::Snapshot& snapshot)
+{
+    if (size < 4 || !initial_memory)
+    {
+        return false;
+    }
+
+    // The size comes from the file, so it's checked before anything is allocated. Run length encoding at worst
+    // doubles the dynamic memory, and the stack is at most 64K words.
+    uLongf raw_size = data[0] | (data[1] << 8) | (data[2] << 16) | ((uLongf)data[3] << 24);
+    size_t max_raw_size = snapshot_fixed_size + initial_memory->size() * 2 + 64 * 1024 * 2;
+
+    if (raw_size > max_raw_size)
+    {
+        logf("SnapshotCodec::decode: Snapshot claims %lu bytes, more than a snapshot of the story can hold\n", (unsigned long)raw_size);
+        return false;
+    }
+
+    std::vector<uint8_t> raw(raw_size);
+    int result = uncompress(raw.data(), &raw_size, data + 4, (uLong)(size - 4));
+
+    if (result != Z_OK || raw_size != raw.size())
+    {
+        logf("SnapshotCodec::decode: Decompression failed [%d]\n", result);
+        return false;
+    }
+
+    SnapshotReader reader(raw.data(), raw.size());
+    snapshot.release_number = (uint16_t)reader.get(2);
+
+    for (uint8_t& c : snapshot.serial)
+    {
+        c = (uint8_t)reader.get(1);
+    }
+
+    snapshot.checksum = (uint16_t)reader.get(2);
+    snapshot.pc = (uint32_t)reader.get(4);
+    snapshot.sp = (uint16_t)reader.get(2);
+    snapshot.locals_base = (uint16_t)reader.get(2);
+    snapshot.instruction.opcode = (uint16_t)reader.get(2);
+    snapshot.instruction.operand_count = (uint8_t)reader.get(1);
+
+    for (uint8_t& type : snapshot.instruction.operand_types)
+    {
+        type = (uint8_t)reader.get(1);
+    }
+
+    for (uint16_t& operand : snapshot.instruction.operands)
+    {
+        operand = (uint16_t)reader.get(2);
+    }
+
+    snapshot.input_timeout = (uint16_t)reader.get(2);
+    snapshot.input_routine = (uint16_t)reader.get(2);
+    snapshot.window = (uint8_t)reader.get(1);
+    snapshot.text_style = (TextStyle::Type)reader.get(1);
+
+    for (uint64_t& s : snapshot.random.s)
+    {
+        s = reader.get(8);
+    }
+
+    snapshot.random.mode = (Random::Mode)reader.get(1);
+    snapshot.random.sequence_limit = (uint16_t)reader.get(2);
+    snapshot.random.sequence_next = (uint16_t)reader.get(2);
+    snapshot.memory_size = (uint32_t)reader.get(4);
+    uint32_t stack_words = (uint32_t)reader.get(4);
+
+    if (!reader.ok() || snapshot.memory_size != initial_memory->size() || stack_words > (size_t)(reader.end() - reader.position()) / 2)
+    {
+        logm("SnapshotCodec::decode: Snapshot truncated or of a different story\n");
+        return false;
+    }
+
+    snapshot.stack.resize(stack_words);
+
+    for (uint16_t& word : snapshot.stack)
+    {
+        word = (uint16_t)reader.get(2);
+    }
+
+    // Undo the XOR-RLE into fresh pages
+    std::vector<uint8_t> memory(*initial_memory);
+    const uint8_t* in = reader.position();
+    uint32_t addr = 0;
+
+    while (in < reader.end())
+    {
+        if (*in == 0)
+        {
+            addr += (in + 1 < reader.end() ? in[1] : 0) + 1;
+            in += 2;
+        }
+        else if (addr < memory.size())
+        {
+            memory[addr++] ^= *in++;
+        }
+        else
+        {
+            logm("SnapshotCodec::decode: Memory overruns the story's dynamic memory\n");
+            return false;
+        }
+    }
+
+    snapshot.pages.clear();
+
+    for (uint32_t offset = 0; offset < snapshot.memory_size; offset += ZMachine::snapshot_page_size)
+    {
+        std::shared_ptr<ZMachine::SnapshotPage> page = std::make_shared<ZMachine::SnapshotPage>();
+        uint32_t page_size = std::min(ZMachine::snapshot_page_size, snapshot.memory_size - offset);
+        memcpy(page->bytes, memory.data() + offset, page_size);
+        memset(page->bytes + page_size, 0, ZMachine::snapshot_page_size - page_size);
+        snapshot.pages.push_back(std::move(page));
+    }
+
+    snapshot.initial_memory = initial_memory;
+    return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "zmachine.h"
+
+
+/*
+    Encoded snapshot layout, little endian, everything after the first 4 bytes deflated with zlib:
+    4 bytes     - size of the data before deflating
+    2 bytes     - story release number
+    6 bytes     - story serial
+    2 bytes     - story checksum
+    4 bytes     - pc
+    2 bytes     - sp
+    2 bytes     - locals base
+    37 bytes    - input instruction: opcode (2), operand count (1), operand types (8), operands (8 x 2)
+    2 bytes     - input timeout
+    2 bytes     - input routine
+    1 byte      - window
+    1 byte      - text style
+    37 bytes    - random state: s (4 x 8), mode (1), sequence limit (2), sequence next (2)
+    4 bytes     - dynamic memory size
+    4 bytes     - stack words, then the words
+    dynamic memory XORed with the story's initial dynamic memory and run length encoded as in Quetzal's CMem chunk:
+    a zero byte is followed by the number of further zero bytes (0-255), trailing zeros are left out
+*/
+class SnapshotCodec
+{
+public:
+    static bool encode(const ZMachine::Snapshot& snapshot, std::vector<uint8_t>& data);
+
+    // initial_memory is the dynamic memory of the story as loaded, see ZMachine::initial_memory()
+    static bool decode(const uint8_t* data, size_t size, const std::shared_ptr<const std::vector<uint8_t>>& initial_memory,
+                       ZMachine::Snapshot& snapshot);
+};
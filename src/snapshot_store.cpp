@@ -0,0 +1,818 @@
+#include "snapshot_store.h"
+
+#include "log.h"
+#include "snapshot_codec.h"
+#include "zlib/zlib.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <io.h>
+
+
+static constexpr char record_magic[4] = { 'Z', 'R', 'E', 'C' };
+static constexpr char segment_prefix[] = "snapshots-";
+static constexpr char segment_suffix[] = ".log";
+
+
+static bool deflate_payload(const std::vector<uint8_t>& raw, std::vector<uint8_t>& payload)
+{
+    uLongf compressed_size = compressBound((uLong)raw.size());
+    payload.resize(4 + compressed_size);
+    uint32_t raw_size = (uint32_t)raw.size();
+    memcpy(payload.data(), &raw_size, 4);
+
+    if (compress2(payload.data() + 4, &compressed_size, raw.data(), (uLong)raw.size(), Z_DEFAULT_COMPRESSION) != Z_OK)
+    {
+        return false;
+    }
+
+    payload.resize(4 + compressed_size);
+    return true;
+}
+
+
+static bool inflate_payload(const std::vector<uint8_t>& payload, std::vector<uint8_t>& raw)
+{
+    uint32_t raw_size = 0;
+
+    if (payload.size() < 4)
+    {
+        return false;
+    }
+
+    // Base records hold a story's dynamic memory, which the 16-bit static memory base keeps under 64K
+    memcpy(&raw_size, payload.data(), 4);
+
+    if (raw_size > 64 * 1024)
+    {
+        return false;
+    }
+
+    raw.resize(raw_size);
+    uLongf size = raw_size;
+    return uncompress(raw.data(), &size, payload.data() + 4, (uLong)(payload.size() - 4)) == Z_OK && size == raw_size;
+}
+
+
+SnapshotStore::SnapshotStore(uint64_t segment_size) : _segment_size(segment_size) {}
+
+
+SnapshotStore::~SnapshotStore()
+{
+    close();
+}
+
+
+bool SnapshotStore::open(const char* directory)
+{
+    close();
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    _directory = directory;
+
+    // Segments are numbered in the order they were started
+    std::vector<uint32_t> segments;
+
+    for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(_directory, error))
+    {
+        std::string name = entry.path().filename().string();
+        size_t prefix = sizeof(segment_prefix) - 1;
+        size_t suffix = sizeof(segment_suffix) - 1;
+
+        if (name.size() > prefix + suffix && name.compare(0, prefix, segment_prefix) == 0 &&
+            name.compare(name.size() - suffix, suffix, segment_suffix) == 0)
+        {
+            segments.push_back((uint32_t)strtoul(name.c_str() + prefix, nullptr, 10));
+        }
+    }
+
+    if (error)
+    {
+        logf("SnapshotStore::open: Can't read directory '%s'\n", directory);
+        return false;
+    }
+
+    std::sort(segments.begin(), segments.end());
+
+    for (uint32_t segment : segments)
+    {
+        if (!scan_segment(segment))
+        {
+            _sessions.clear();
+            _bases.clear();
+            _segments.clear();
+            return false;
+        }
+    }
+
+    _active_segment = segments.empty() ? 0 : segments.back();
+    _active = segments.empty() ? nullptr : fopen(segment_path(_active_segment).c_str(), "ab");
+
+    if (!_active && !start_segment())
+    {
+        return false;
+    }
+
+    _stop = false;
+    _thread = std::thread(&SnapshotStore::run, this);
+    return true;
+}
+
+
+void SnapshotStore::close()
+{
+    if (_thread.joinable())
+    {
+        flush();
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+
+        _wake.notify_one();
+        _thread.join();
+    }
+
+    if (_active)
+    {
+        fclose(_active);
+        _active = nullptr;
+    }
+
+    _sessions.clear();
+    _bases.clear();
+    _segments.clear();
+    _unwritten.clear();
+    _stats = Stats{};
+    _sequence = 0;
+    _failed = false;
+}
+
+
+bool SnapshotStore::put(uint64_t session, const ZMachine::Snapshot& snapshot)
+{
+    if (session == 0 || !snapshot.initial_memory)
+    {
+        return false;
+    }
+
+    // Shares the snapshot's pages, the copy is only pointers and the stack
+    std::shared_ptr<const ZMachine::Snapshot> copy = std::make_shared<const ZMachine::Snapshot>(snapshot);
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (!_thread.joinable() || _failed)
+        {
+            return false;
+        }
+
+        _pending.push_back(Pending{ Snapshot, session, copy });
+        _unwritten[session] = copy;
+    }
+
+    _wake.notify_one();
+    return true;
+}
+
+
+bool SnapshotStore::remove(uint64_t session)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (!_thread.joinable() || _failed)
+        {
+            return false;
+        }
+
+        _pending.push_back(Pending{ Remove, session, nullptr });
+        _unwritten[session] = nullptr;
+    }
+
+    _wake.notify_one();
+    return true;
+}
+
+
+bool SnapshotStore::get(uint64_t session, ZMachine::Snapshot& snapshot)
+{
+    // Compaction can move the record between finding it and reading it, in which case it's found again
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        Location location;
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            std::unordered_map<uint64_t, std::shared_ptr<const ZMachine::Snapshot>>::const_iterator unwritten = _unwritten.find(session);
+
+            if (unwritten != _unwritten.end())
+            {
+                if (!unwritten->second)
+                {
+                    return false;
+                }
+
+                snapshot = *unwritten->second;
+                return true;
+            }
+
+            std::unordered_map<uint64_t, Location>::const_iterator it = _sessions.find(session);
+
+            if (it == _sessions.end() || it->second.type == Remove)
+            {
+                return false;
+            }
+
+            location = it->second;
+        }
+
+        RecordHeader header;
+        std::vector<uint8_t> payload;
+
+        if (!read_record(location, header, payload) || header.session != session || header.type != Snapshot)
+        {
+            continue;
+        }
+
+        std::shared_ptr<const std::vector<uint8_t>> base = base_memory(location.story);
+        return base && SnapshotCodec::decode(payload.data(), payload.size(), base, snapshot);
+    }
+
+    logf("SnapshotStore::get: Failed to read snapshot of session %llu\n", (unsigned long long)session);
+    return false;
+}
+
+
+bool SnapshotStore::flush()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idle.wait(lock, [this]() { return (_pending.empty() && !_writing) || !_thread.joinable(); });
+    return !_failed;
+}
+
+
+SnapshotStore::Stats SnapshotStore::stats()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    Stats stats = _stats;
+    stats.sessions = 0;
+    stats.live_bytes = 0;
+    stats.dead_bytes = 0;
+    stats.segments = (uint32_t)_segments.size();
+
+    for (const std::pair<const uint64_t, Location>& session : _sessions)
+    {
+        stats.sessions += session.second.type != Remove;
+    }
+
+    for (const std::pair<const uint32_t, Segment>& segment : _segments)
+    {
+        stats.live_bytes += segment.second.size - segment.second.dead;
+        stats.dead_bytes += segment.second.dead;
+    }
+
+    return stats;
+}
+
+
+std::string SnapshotStore::segment_path(uint32_t segment) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%s%06u%s", segment_prefix, segment, segment_suffix);
+    return (std::filesystem::path(_directory) / name).string();
+}
+
+
+bool SnapshotStore::scan_segment(uint32_t segment)
+{
+    std::string path = segment_path(segment);
+    FILE* file = fopen(path.c_str(), "rb");
+
+    if (!file)
+    {
+        logf("SnapshotStore::scan_segment: Failed to open '%s'\n", path.c_str());
+        return false;
+    }
+
+    _fseeki64(file, 0, SEEK_END);
+    uint64_t file_size = (uint64_t)_ftelli64(file);
+    _fseeki64(file, 0, SEEK_SET);
+
+    uint64_t offset = 0;
+    RecordHeader header;
+    std::vector<uint8_t> payload;
+    _segments[segment] = Segment{ 0, 0 };
+
+    while (offset < file_size)
+    {
+        // A record that is cut short or doesn't check out ends the segment; it can only be the tail of the last
+        // commit before a crash
+        bool valid = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, record_magic, 4) == 0 &&
+                     header.type >= Base && header.type <= Remove && header.size <= file_size - offset - sizeof(header);
+
+        if (valid)
+        {
+            payload.resize(header.size);
+            valid = fread(payload.data(), 1, header.size, file) == header.size && crc32(0, payload.data(), header.size) == header.crc;
+        }
+
+        if (!valid)
+        {
+            logf("SnapshotStore::scan_segment: Dropping damaged records from offset %llu of '%s'\n", (unsigned long long)offset,
+                 path.c_str());
+            fclose(file);
+            std::error_code error;
+            std::filesystem::resize_file(path, offset, error);
+            file = nullptr;
+            break;
+        }
+
+        Location location{ segment, offset, (uint32_t)(sizeof(header) + header.size),
+                           StoryKey(header.release_number, header.serial, header.checksum), header.sequence, header.type };
+        _segments[segment].size = offset + location.size;
+        add_record(header, location);
+        _sequence = std::max(_sequence, header.sequence);
+        offset += location.size;
+    }
+
+    if (file)
+    {
+        fclose(file);
+    }
+
+    return true;
+}
+
+
+void SnapshotStore::add_record(const RecordHeader& header, const Location& location)
+{
+    // Records can be found out of order once compaction has moved some, the sequence number decides which is current
+    Location* current = nullptr;
+
+    if (header.type == Base)
+    {
+        StoryBases::iterator it = _bases.find(location.story);
+        current = it == _bases.end() ? nullptr : &it->second.location;
+
+        if (!current)
+        {
+            _bases[location.story] = StoryBase{ location, nullptr };
+            return;
+        }
+    }
+    else
+    {
+        std::unordered_map<uint64_t, Location>::iterator it = _sessions.find(header.session);
+        current = it == _sessions.end() ? nullptr : &it->second;
+
+        if (!current)
+        {
+            _sessions[header.session] = location;
+            return;
+        }
+    }
+
+    if (location.sequence < current->sequence)
+    {
+        _segments[location.segment].dead += location.size;
+    }
+    else
+    {
+        _segments[current->segment].dead += current->size;
+        *current = location;
+    }
+}
+
+
+bool SnapshotStore::read_record(const Location& location, RecordHeader& header, std::vector<uint8_t>& payload)
+{
+    std::shared_lock<std::shared_mutex> lock(_segment_files);
+    FILE* file = fopen(segment_path(location.segment).c_str(), "rb");
+
+    if (!file)
+    {
+        return false;
+    }
+
+    bool valid = _fseeki64(file, (int64_t)location.offset, SEEK_SET) == 0 && fread(&header, sizeof(header), 1, file) == 1 &&
+                 memcmp(header.magic, record_magic, 4) == 0 && sizeof(header) + header.size == location.size;
+
+    if (valid)
+    {
+        payload.resize(header.size);
+        valid = fread(payload.data(), 1, header.size, file) == header.size && crc32(0, payload.data(), header.size) == header.crc;
+    }
+
+    fclose(file);
+    return valid;
+}
+
+
+std::shared_ptr<const std::vector<uint8_t>> SnapshotStore::base_memory(const StoryKey& story)
+{
+    Location location;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        StoryBases::const_iterator it = _bases.find(story);
+
+        if (it == _bases.end())
+        {
+            return nullptr;
+        }
+
+        if (it->second.memory)
+        {
+            return it->second.memory;
+        }
+
+        location = it->second.location;
+    }
+
+    RecordHeader header;
+    std::vector<uint8_t> payload;
+    std::vector<uint8_t> memory;
+
+    if (!read_record(location, header, payload) || header.type != Base || !inflate_payload(payload, memory))
+    {
+        logm("SnapshotStore::base_memory: Failed to read story base\n");
+        return nullptr;
+    }
+
+    std::shared_ptr<const std::vector<uint8_t>> shared = std::make_shared<const std::vector<uint8_t>>(std::move(memory));
+    std::lock_guard<std::mutex> lock(_mutex);
+    _bases[story].memory = shared;
+    return shared;
+}
+
+
+bool SnapshotStore::start_segment()
+{
+    if (_active)
+    {
+        fclose(_active);
+    }
+
+    // The active segment is always the newest
+    _active_segment++;
+    _active = fopen(segment_path(_active_segment).c_str(), "ab");
+
+    if (!_active)
+    {
+        // Without a segment to write to the store takes no more records, as after a failed write
+        logf("SnapshotStore::start_segment: Failed to create segment %u\n", _active_segment);
+        std::lock_guard<std::mutex> lock(_mutex);
+        _failed = true;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _segments[_active_segment] = Segment{ 0, 0 };
+    return true;
+}
+
+
+void SnapshotStore::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    bool compacted = false;
+
+    for (;;)
+    {
+        // Keeps compacting without waiting while there are segments to compact
+        std::chrono::seconds timeout(compacted ? 0 : 1);
+        _wake.wait_for(lock, timeout, [this]() { return _stop || !_pending.empty(); });
+        compacted = false;
+
+        if (!_pending.empty())
+        {
+            // Everything queued so far goes out in one write
+            std::vector<Pending> batch;
+            batch.swap(_pending);
+            _writing = true;
+            lock.unlock();
+
+            commit(batch);
+
+            lock.lock();
+            _writing = false;
+            _idle.notify_all();
+        }
+        else if (_stop)
+        {
+            return;
+        }
+        else
+        {
+            // Idle, compact a segment if one is mostly dead records
+            lock.unlock();
+            compacted = compact();
+            lock.lock();
+
+            if (compacted)
+            {
+                _stats.compactions++;
+            }
+        }
+    }
+}
+
+
+void SnapshotStore::commit(std::vector<Pending>& batch)
+{
+    {
+        // Nothing more is written once a write has failed, the records stay readable from _unwritten
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_failed)
+        {
+            return;
+        }
+    }
+
+    std::vector<uint8_t> data;
+    std::vector<std::pair<RecordHeader, uint64_t>> records;    // Header and offset in data
+    std::vector<uint8_t> payload;
+    std::vector<StoryKey> new_bases;
+
+    for (const Pending& pending : batch)
+    {
+        RecordHeader header{};
+        memcpy(header.magic, record_magic, 4);
+        header.session = pending.session;
+        payload.clear();
+
+        if (pending.type == Snapshot)
+        {
+            const ZMachine::Snapshot& snapshot = *pending.snapshot;
+            StoryKey story(snapshot.release_number, snapshot.serial, snapshot.checksum);
+            header.release_number = snapshot.release_number;
+            memcpy(header.serial, snapshot.serial, sizeof(header.serial));
+            header.checksum = snapshot.checksum;
+
+            bool have_base = std::find(new_bases.begin(), new_bases.end(), story) != new_bases.end();
+
+            if (!have_base)
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                have_base = _bases.count(story) != 0;
+            }
+
+            // A story's initial memory is stored once, ahead of its first snapshot
+            if (!have_base && deflate_payload(*snapshot.initial_memory, payload))
+            {
+                RecordHeader base = header;
+                base.type = Base;
+                base.session = 0;
+                base.sequence = ++_sequence;
+                base.size = (uint32_t)payload.size();
+                base.crc = crc32(0, payload.data(), base.size);
+                records.emplace_back(base, data.size());
+                data.insert(data.end(), (const uint8_t*)&base, (const uint8_t*)&base + sizeof(base));
+                data.insert(data.end(), payload.begin(), payload.end());
+                new_bases.push_back(story);
+            }
+
+            if (!SnapshotCodec::encode(snapshot, payload))
+            {
+                continue;
+            }
+
+            header.type = Snapshot;
+        }
+        else
+        {
+            header.type = Remove;
+        }
+
+        header.sequence = ++_sequence;
+        header.size = (uint32_t)payload.size();
+        header.crc = crc32(0, payload.data(), header.size);
+        records.emplace_back(header, data.size());
+        data.insert(data.end(), (const uint8_t*)&header, (const uint8_t*)&header + sizeof(header));
+        data.insert(data.end(), payload.begin(), payload.end());
+    }
+
+    uint64_t base_offset = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        base_offset = _segments[_active_segment].size;
+    }
+
+    // One write and one flush to disk for the whole batch
+    if (!append(data, base_offset))
+    {
+        logf("SnapshotStore::commit: Failed to write %zu records, the store takes no more\n", records.size());
+        return;
+    }
+
+    bool full = false;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        for (const Pending& pending : batch)
+        {
+            // A later put or remove for the session may be queued already
+            std::unordered_map<uint64_t, std::shared_ptr<const ZMachine::Snapshot>>::iterator it = _unwritten.find(pending.session);
+
+            if (it != _unwritten.end() && it->second == pending.snapshot)
+            {
+                _unwritten.erase(it);
+            }
+        }
+
+        for (const std::pair<RecordHeader, uint64_t>& record : records)
+        {
+            const RecordHeader& header = record.first;
+            Location location{ _active_segment, base_offset + record.second, (uint32_t)(sizeof(header) + header.size),
+                               StoryKey(header.release_number, header.serial, header.checksum), header.sequence, header.type };
+            add_record(header, location);
+        }
+
+        _segments[_active_segment].size = base_offset + data.size();
+        _stats.records += records.size();
+        _stats.batches++;
+        full = _segments[_active_segment].size >= _segment_size;
+    }
+
+    if (full && !start_segment())
+    {
+        logm("SnapshotStore::commit: Failed to start a new segment, the store takes no more\n");
+    }
+}
+
+
+bool SnapshotStore::append(const std::vector<uint8_t>& data, uint64_t offset)
+{
+    if (!_active)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _failed = true;
+        return false;
+    }
+
+    if (fwrite(data.data(), 1, data.size(), _active) == data.size() && fflush(_active) == 0 && _commit(_fileno(_active)) == 0)
+    {
+        return true;
+    }
+
+    // A torn write would hide every later record from the scan at open, so the segment goes back to where it was.
+    // The store stops taking records either way, since it can't tell what else of the disk is still good.
+    clearerr(_active);
+    _chsize_s(_fileno(_active), (int64_t)offset);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _failed = true;
+    return false;
+}
+
+
+bool SnapshotStore::compact()
+{
+    uint32_t victim = 0;
+    uint32_t oldest = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        uint64_t most_dead = 0;
+
+        if (_failed)
+        {
+            return false;
+        }
+
+        for (const std::pair<const uint32_t, Segment>& segment : _segments)
+        {
+            oldest = oldest ? std::min(oldest, segment.first) : segment.first;
+
+            if (segment.first != _active_segment && segment.second.dead * 2 > segment.second.size && segment.second.dead > most_dead)
+            {
+                victim = segment.first;
+                most_dead = segment.second.dead;
+            }
+        }
+    }
+
+    if (!victim)
+    {
+        return false;
+    }
+
+    std::string path = segment_path(victim);
+    FILE* file = fopen(path.c_str(), "rb");
+    std::vector<uint8_t> contents;
+
+    if (file)
+    {
+        _fseeki64(file, 0, SEEK_END);
+        contents.resize((size_t)_ftelli64(file));
+        _fseeki64(file, 0, SEEK_SET);
+        contents.resize(fread(contents.data(), 1, contents.size(), file));
+        fclose(file);
+    }
+
+    // Records the index still points at move to the active segment. Removals have to stay until no older record of
+    // their session can be left in an earlier segment, which is once they reach the oldest.
+    std::vector<uint8_t> live;
+    std::vector<std::pair<RecordHeader, uint64_t>> moved;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        for (uint64_t offset = 0; offset + sizeof(RecordHeader) <= contents.size();)
+        {
+            RecordHeader header;
+            memcpy(&header, contents.data() + offset, sizeof(header));
+            uint64_t size = sizeof(header) + header.size;
+
+            if (offset + size > contents.size())
+            {
+                break;
+            }
+
+            const Location* current = nullptr;
+
+            if (header.type == Base)
+            {
+                StoryBases::const_iterator it = _bases.find(StoryKey(header.release_number, header.serial, header.checksum));
+                current = it == _bases.end() ? nullptr : &it->second.location;
+            }
+            else
+            {
+                std::unordered_map<uint64_t, Location>::const_iterator it = _sessions.find(header.session);
+                current = it == _sessions.end() ? nullptr : &it->second;
+            }
+
+            if (current && current->segment == victim && current->offset == offset)
+            {
+                if (header.type == Remove && victim == oldest)
+                {
+                    _sessions.erase(header.session);
+                }
+                else
+                {
+                    moved.emplace_back(header, live.size());
+                    live.insert(live.end(), contents.data() + offset, contents.data() + offset + size);
+                }
+            }
+
+            offset += size;
+        }
+    }
+
+    uint64_t base_offset = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        base_offset = _segments[_active_segment].size;
+    }
+
+    if (!live.empty() && !append(live, base_offset))
+    {
+        logf("SnapshotStore::compact: Failed to move records out of segment %u\n", victim);
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        for (const std::pair<RecordHeader, uint64_t>& record : moved)
+        {
+            const RecordHeader& header = record.first;
+            Location location{ _active_segment, base_offset + record.second, (uint32_t)(sizeof(header) + header.size),
+                               StoryKey(header.release_number, header.serial, header.checksum), header.sequence, header.type };
+            Location* current = header.type == Base ? &_bases[location.story].location : &_sessions[header.session];
+            *current = location;
+        }
+
+        _segments[_active_segment].size = base_offset + live.size();
+        _stats.records += moved.size();
+    }
+
+    {
+        std::unique_lock<std::shared_mutex> files(_segment_files);
+        std::error_code error;
+        std::filesystem::remove(path, error);
+    }
+
+    bool full = false;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _segments.erase(victim);
+        full = _segments[_active_segment].size >= _segment_size;
+    }
+
+    if (full && !start_segment())
+    {
+        logm("SnapshotStore::compact: Failed to start a new segment, the store takes no more\n");
+    }
+
+    return true;
+}
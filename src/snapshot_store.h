@@ -0,0 +1,163 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "story_key.h"
+#include "zmachine.h"
+
+
+/*
+    Append-only store for the snapshots of many sessions. Records go to numbered segment files in one directory:
+
+    4 bytes     - "ZREC"
+    1 byte      - record type (base, snapshot, remove)
+    1 byte      - reserved
+    2 bytes     - story release number
+    6 bytes     - story serial
+    2 bytes     - story checksum
+    8 bytes     - session id (0 for base records)
+    8 bytes     - sequence number, the latest record for a session wins
+    4 bytes     - payload size
+    4 bytes     - CRC-32 of the payload
+    payload
+
+    A base record holds a story's initial dynamic memory, deflated, and is written once per story. Snapshot records
+    are encoded by SnapshotCodec, so they only hold the difference from their story's base. Opening the store scans
+    the segments to rebuild the index; a record cut short by a crash is dropped.
+
+    Once a closed segment is mostly superseded records, the store's thread copies what is still live to the newest
+    segment and deletes it.
+*/
+class SnapshotStore
+{
+public:
+    struct Stats
+    {
+        uint64_t sessions;
+        uint64_t records;       // Records written since the store was opened, including those moved by compaction
+        uint64_t batches;       // Group commits
+        uint64_t live_bytes;
+        uint64_t dead_bytes;    // Superseded records waiting for compaction
+        uint64_t compactions;
+        uint32_t segments;
+    };
+
+    // Segments are closed and a new one started once they reach segment_size bytes
+    explicit SnapshotStore(uint64_t segment_size = 64 * 1024 * 1024);
+    ~SnapshotStore();
+
+    SnapshotStore(const SnapshotStore&) = delete;
+    SnapshotStore& operator=(const SnapshotStore&) = delete;
+
+    bool open(const char* directory);
+    void close();
+
+    // Queued and written by the store's thread along with any other pending records in one commit. Reads see queued
+    // records straight away. Once a write has failed the store takes no more records; those it couldn't write can
+    // still be read until it's closed.
+    bool put(uint64_t session, const ZMachine::Snapshot& snapshot);
+    bool remove(uint64_t session);
+
+    bool get(uint64_t session, ZMachine::Snapshot& snapshot);
+
+    // Blocks until every queued record has been committed, false if a write has failed
+    bool flush();
+
+    Stats stats();
+
+private:
+    enum RecordType : uint8_t
+    {
+        Base = 1,
+        Snapshot = 2,
+        Remove = 3
+    };
+
+    struct RecordHeader
+    {
+        char magic[4];
+        uint8_t type;
+        uint8_t reserved;
+        uint16_t release_number;
+        uint8_t serial[6];
+        uint16_t checksum;
+        uint64_t session;
+        uint64_t sequence;
+        uint32_t size;
+        uint32_t crc;
+    };
+
+    static_assert(sizeof(RecordHeader) == 40, "Record headers are written as they are");
+
+    struct Location
+    {
+        uint32_t segment;
+        uint64_t offset;        // Of the record header
+        uint32_t size;          // Header and payload
+        StoryKey story;
+        uint64_t sequence;
+        uint8_t type;
+    };
+
+    struct StoryBase
+    {
+        Location location;
+        std::shared_ptr<const std::vector<uint8_t>> memory;   // Loaded on first use
+    };
+
+    struct Segment
+    {
+        uint64_t size;
+        uint64_t dead;
+    };
+
+    using StoryBases = std::unordered_map<StoryKey, StoryBase, StoryKey::Hash>;
+
+    struct Pending
+    {
+        RecordType type;
+        uint64_t session;
+        std::shared_ptr<const ZMachine::Snapshot> snapshot;
+    };
+
+    uint64_t _segment_size;
+    std::string _directory;
+    std::unordered_map<uint64_t, Location> _sessions;
+    StoryBases _bases;
+    std::unordered_map<uint32_t, Segment> _segments;
+    std::vector<Pending> _pending;
+    std::unordered_map<uint64_t, std::shared_ptr<const ZMachine::Snapshot>> _unwritten; // Latest queued per session
+    uint32_t _active_segment{};
+    FILE* _active = nullptr;
+    uint64_t _sequence{};
+    Stats _stats{};
+    bool _writing = false;
+    bool _stop = false;
+    bool _failed = false;
+    std::mutex _mutex;
+    std::shared_mutex _segment_files;   // Held exclusively while compaction deletes a segment
+    std::condition_variable _wake;
+    std::condition_variable _idle;
+    std::thread _thread;
+
+    std::string segment_path(uint32_t segment) const;
+    bool scan_segment(uint32_t segment);
+    void add_record(const RecordHeader& header, const Location& location);
+    bool read_record(const Location& location, RecordHeader& header, std::vector<uint8_t>& payload);
+    std::shared_ptr<const std::vector<uint8_t>> base_memory(const StoryKey& story);
+    bool start_segment();
+
+    void run();
+    void commit(std::vector<Pending>& batch);
+    bool append(const std::vector<uint8_t>& data, uint64_t offset);
+    bool compact();
+};
@@ -0,0 +1,251 @@
+#include "story_image.h"
+
+#include "log.h"
+
+#include <cstdio>
+#include <cstring>
+
+
+static constexpr char image_magic[4] = { 'Z', 'I', 'M', 'G' };
+static constexpr uint32_t image_byte_order = 0x01020304;
+static constexpr uint16_t image_version = 1;
+static constexpr size_t story_alignment = 4096;
+static constexpr size_t section_alignment = 16;
+
+struct ImageHeader
+{
+    char magic[4];
+    uint32_t byte_order;
+    uint16_t version;
+    uint16_t section_count;
+    uint16_t release_number;
+    uint8_t serial[6];
+    uint16_t checksum;
+    uint16_t reserved;
+    uint32_t story_size;
+};
+
+struct ImageSection
+{
+    uint32_t type;
+    uint32_t offset;
+    uint32_t size;
+};
+
+static_assert(sizeof(ImageHeader) == 28, "Story image header layout");
+static_assert(sizeof(ImageSection) == 12, "Story image section layout");
+
+
+static uint16_t story_word(const uint8_t* story, uint32_t addr)
+{
+    return (story[addr] << 8) | story[addr + 1];
+}
+
+
+static size_t align(size_t offset, size_t alignment)
+{
+    return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+
+bool StoryImage::is_image(const uint8_t* data, size_t size)
+{
+    return size >= sizeof(ImageHeader) && memcmp(data, image_magic, sizeof(image_magic)) == 0;
+}
+
+
+bool StoryImage::open(uint8_t* data, size_t size)
+{
+    _data = nullptr;
+    _size = 0;
+    _section_count = 0;
+
+    if (!is_image(data, size))
+    {
+        logm("StoryImage::open: Not a story image\n");
+        return false;
+    }
+
+    ImageHeader header;
+    memcpy(&header, data, sizeof(header));
+
+    if (header.byte_order != image_byte_order || header.version != image_version)
+    {
+        logf("StoryImage::open: Unsupported image version %d\n", header.version);
+        return false;
+    }
+
+    if (sizeof(ImageHeader) + header.section_count * sizeof(ImageSection) > size)
+    {
+        logm("StoryImage::open: Section table truncated\n");
+        return false;
+    }
+
+    const ImageSection* sections = (const ImageSection*)(data + sizeof(ImageHeader));
+
+    for (uint16_t i = 0; i < header.section_count; ++i)
+    {
+        if (sections[i].offset > size || sections[i].size > size - sections[i].offset || sections[i].offset % section_alignment)
+        {
+            logf("StoryImage::open: Section %d out of range\n", sections[i].type);
+            return false;
+        }
+    }
+
+    _data = data;
+    _size = size;
+    _section_count = header.section_count;
+
+    // The tables were built from the story in the image; make sure it's the story the header says it is
+    size_t story_size = 0;
+    const uint8_t* story = section(StoryImageSection::Story, story_size);
+
+    if (story && !matches(story, story_size))
+    {
+        logm("StoryImage::open: Story doesn't match the image header\n");
+        _data = nullptr;
+        _size = 0;
+        _section_count = 0;
+        return false;
+    }
+
+    return true;
+}
+
+
+bool StoryImage::matches(const uint8_t* story, size_t size) const
+{
+    if (!_data)
+    {
+        return false;
+    }
+
+    ImageHeader header;
+    memcpy(&header, _data, sizeof(header));
+    return size == header.story_size && size >= 64 && story_word(story, 0x02) == header.release_number &&
+           memcmp(story + 0x12, header.serial, sizeof(header.serial)) == 0 && story_word(story, 0x1C) == header.checksum;
+}
+
+
+uint8_t* StoryImage::section(StoryImageSection::Type type, size_t& size) const
+{
+    const ImageSection* sections = (const ImageSection*)(_data + sizeof(ImageHeader));
+
+    for (uint16_t i = 0; i < _section_count; ++i)
+    {
+        if (sections[i].type == type)
+        {
+            size = sections[i].size;
+            return _data + sections[i].offset;
+        }
+    }
+
+    size = 0;
+    return nullptr;
+}
+
+
+void StoryImageWriter::add_section(StoryImageSection::Type type, const void* data, size_t size)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    _sections.push_back(Section{ type, std::vector<uint8_t>(bytes, bytes + size) });
+}
+
+
+bool StoryImageWriter::build(std::vector<uint8_t>& image, bool with_story) const
+{
+    const Section* story = nullptr;
+
+    for (const Section& section : _sections)
+    {
+        if (section.type == StoryImageSection::Story)
+        {
+            story = &section;
+        }
+    }
+
+    if (!story || story->data.size() < 64)
+    {
+        logm("StoryImageWriter::build: No story to write\n");
+        return false;
+    }
+
+    ImageHeader header{};
+    memcpy(header.magic, image_magic, sizeof(image_magic));
+    header.byte_order = image_byte_order;
+    header.version = image_version;
+    header.section_count = (uint16_t)(_sections.size() - (with_story ? 0 : 1));
+    header.release_number = story_word(story->data.data(), 0x02);
+    memcpy(header.serial, story->data.data() + 0x12, sizeof(header.serial));
+    header.checksum = story_word(story->data.data(), 0x1C);
+    header.story_size = (uint32_t)story->data.size();
+
+    // Story first so its dynamic memory pages don't share a page with the tables
+    std::vector<ImageSection> table;
+    size_t offset = sizeof(ImageHeader) + header.section_count * sizeof(ImageSection);
+
+    if (with_story)
+    {
+        offset = align(offset, story_alignment);
+        table.push_back(ImageSection{ story->type, (uint32_t)offset, (uint32_t)story->data.size() });
+        offset += story->data.size();
+    }
+
+    for (const Section& section : _sections)
+    {
+        if (&section != story)
+        {
+            offset = align(offset, section_alignment);
+            table.push_back(ImageSection{ section.type, (uint32_t)offset, (uint32_t)section.data.size() });
+            offset += section.data.size();
+        }
+    }
+
+    image.assign(offset, 0);
+    memcpy(image.data(), &header, sizeof(header));
+    memcpy(image.data() + sizeof(header), table.data(), table.size() * sizeof(ImageSection));
+
+    if (with_story)
+    {
+        memcpy(image.data() + table[0].offset, story->data.data(), story->data.size());
+    }
+
+    for (size_t i = with_story ? 1 : 0, s = 0; s < _sections.size(); ++s)
+    {
+        if (&_sections[s] != story)
+        {
+            memcpy(image.data() + table[i++].offset, _sections[s].data.data(), _sections[s].data.size());
+        }
+    }
+
+    return true;
+}
+
+
+bool StoryImageWriter::write(const char* path) const
+{
+    std::vector<uint8_t> image;
+
+    if (!build(image))
+    {
+        return false;
+    }
+
+    FILE* file = fopen(path, "wb");
+
+    if (!file)
+    {
+        logf("StoryImageWriter::write: Failed to open '%s'\n", path);
+        return false;
+    }
+
+    bool written = fwrite(image.data(), 1, image.size(), file) == image.size();
+    written = (fclose(file) == 0) && written;
+
+    if (!written)
+    {
+        logf("StoryImageWriter::write: Failed to write '%s'\n", path);
+    }
+
+    return written;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+/*
+    Story image (.zimg) file layout, all host-endian:
+    4 bytes     - "ZIMG"
+    4 bytes     - 0x01020304, rejects images built on a machine of the other byte order
+    2 bytes     - format version
+    2 bytes     - section count
+    2 bytes     - story release number
+    6 bytes     - story serial
+    2 bytes     - story checksum
+    2 bytes     - reserved
+    4 bytes     - story size
+    sections    - (type, offset, size) as three 4 byte values each
+    section data
+
+    The story section is the story file exactly as it was loaded and starts on a page boundary. Every other section
+    starts on a 16 byte boundary and holds a table in the layout the interpreter uses it in, so a mapped image is used
+    in place and every process running the story shares the same pages. An image kept in memory next to the story it
+    was built from can leave the story section out.
+*/
+namespace StoryImageSection
+{
+typedef uint32_t Type;
+
+enum Types
+{
+    Story = 1,
+    Codec = 2,
+    Dictionary = 3,
+    PropertyIndex = 4,
+    PrevSiblings = 5
+};
+} // namespace StoryImageSection
+
+
+// A story image in memory, usually a mapped file. The image is only viewed, so it must outlive any use of its sections.
+class StoryImage
+{
+public:
+    static bool is_image(const uint8_t* data, size_t size);
+
+    // Checks the header, the section table and that the story section, if there is one, is the story the header
+    // describes. An image without one must be checked against its story with matches() before it's used.
+    bool open(uint8_t* data, size_t size);
+
+    // True if story is the story the image was built from
+    bool matches(const uint8_t* story, size_t size) const;
+
+    // Start of a section, null if the image doesn't have it
+    uint8_t* section(StoryImageSection::Type type, size_t& size) const;
+
+private:
+    uint8_t* _data = nullptr;
+    size_t _size = 0;
+    uint16_t _section_count{};
+};
+
+
+class StoryImageWriter
+{
+public:
+    // Data is copied, the story section must be added before writing. Without with_story the image only describes
+    // the story in its header and leaves its section out.
+    void add_section(StoryImageSection::Type type, const void* data, size_t size);
+    bool build(std::vector<uint8_t>& image, bool with_story = true) const;
+    bool write(const char* path) const;
+
+private:
+    struct Section
+    {
+        StoryImageSection::Type type;
+        std::vector<uint8_t> data;
+    };
+
+    std::vector<Section> _sections;
+};
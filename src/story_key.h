@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+
+
+// A story's release number, serial and checksum, the same for every copy of a story whatever file it's in. Keys are
+// compared whole, so two stories that share a release and serial but not a checksum stay apart.
+struct StoryKey
+{
+    struct Hash
+    {
+        size_t operator()(const StoryKey& key) const
+        {
+            uint64_t packed = (uint64_t)key.release_number << 48;
+
+            for (int i = 0; i < 6; ++i)
+            {
+                packed |= (uint64_t)key.serial[i] << (40 - i * 8);
+            }
+
+            return std::hash<uint64_t>()(packed) ^ ((size_t)key.checksum * 0x9E3779B97F4A7C15ull);
+        }
+    };
+
+    uint16_t release_number{};
+    uint8_t serial[6]{};
+    uint16_t checksum{};
+
+    StoryKey() = default;
+
+    StoryKey(uint16_t release, const uint8_t* serial_number, uint16_t file_checksum)
+        : release_number(release), checksum(file_checksum)
+    {
+        memcpy(serial, serial_number, sizeof(serial));
+    }
+
+    bool operator==(const StoryKey& other) const
+    {
+        return release_number == other.release_number && checksum == other.checksum &&
+               memcmp(serial, other.serial, sizeof(serial)) == 0;
+    }
+
+    bool operator!=(const StoryKey& other) const { return !(*this == other); }
+};
@@ -0,0 +1,80 @@
+#include "task_pool.h"
+
+#include <algorithm>
+
+
+TaskPool::TaskPool(unsigned threads)
+{
+    if (threads == 0)
+    {
+        threads = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+    }
+
+    for (unsigned i = 0; i < threads; ++i)
+    {
+        _threads.emplace_back(&TaskPool::run, this);
+    }
+}
+
+
+TaskPool::~TaskPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+
+    _wake.notify_all();
+
+    for (std::thread& thread : _threads)
+    {
+        thread.join();
+    }
+}
+
+
+TaskPool& TaskPool::shared()
+{
+    static TaskPool pool;
+    return pool;
+}
+
+
+std::future<void> TaskPool::submit(Task task)
+{
+    std::packaged_task<void()> packaged(std::move(task));
+    std::future<void> future = packaged.get_future();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _queue.push_back(std::move(packaged));
+    }
+
+    _wake.notify_one();
+    return future;
+}
+
+
+void TaskPool::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (;;)
+    {
+        _wake.wait(lock, [this]() { return _stop || !_queue.empty(); });
+
+        // Tasks already queued still run, so nobody is left waiting on a future that never becomes ready
+        if (_queue.empty())
+        {
+            return;
+        }
+
+        std::packaged_task<void()> task = std::move(_queue.front());
+        _queue.pop_front();
+        lock.unlock();
+
+        task();
+
+        lock.lock();
+    }
+}
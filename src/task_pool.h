@@ -0,0 +1,39 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Worker threads shared by everything in a process that splits work into tasks, such as building a story's tables at
+// load. The pool doesn't grow, so a task must not wait for another task.
+class TaskPool
+{
+public:
+    using Task = std::function<void()>;
+
+    // 0 threads is one per hardware thread, less one for the caller, and at least one
+    explicit TaskPool(unsigned threads = 0);
+    ~TaskPool();
+
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+
+    static TaskPool& shared();
+
+    // Tasks start in the order they were submitted. The future is ready once the task has run.
+    std::future<void> submit(Task task);
+
+private:
+    std::deque<std::packaged_task<void()>> _queue;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    bool _stop = false;
+    std::vector<std::thread> _threads;
+
+    void run();
+};
@@ -0,0 +1,105 @@
+#include "timer_wheel.h"
+
+#include <algorithm>
+#include <utility>
+
+
+TimerWheel::TimerWheel(Clock::duration tick, size_t num_slots)
+    : _tick(tick)
+    , _start(Clock::now())
+    , _slots(num_slots)
+{
+}
+
+
+uint64_t TimerWheel::schedule(Clock::time_point deadline, Callback callback)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    // Deadlines in ticks already processed go in the current one
+    uint64_t tick = std::max(tick_for(deadline), _next_tick);
+    uint64_t id = _next_id++;
+    _slots[tick % _slots.size()].push_back(Timer{ id, deadline, std::move(callback) });
+    _timer_ticks[id] = tick;
+    return id;
+}
+
+
+void TimerWheel::cancel(uint64_t id)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::unordered_map<uint64_t, uint64_t>::iterator it = _timer_ticks.find(id);
+
+    if (it == _timer_ticks.end())
+    {
+        return;
+    }
+
+    std::vector<Timer>& slot = _slots[it->second % _slots.size()];
+
+    for (size_t i = 0; i < slot.size(); ++i)
+    {
+        if (slot[i].id == id)
+        {
+            std::swap(slot[i], slot.back());
+            slot.pop_back();
+            break;
+        }
+    }
+
+    _timer_ticks.erase(it);
+}
+
+
+void TimerWheel::advance(Clock::time_point now)
+{
+    std::vector<Timer> expired;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        uint64_t now_tick = tick_for(now);
+
+        if (now_tick < _next_tick)
+        {
+            return;
+        }
+
+        // Each slot is visited at most once, timers for later laps of the wheel stay where they are
+        uint64_t num_ticks = std::min<uint64_t>(now_tick - _next_tick + 1, _slots.size());
+
+        for (uint64_t tick = now_tick + 1 - num_ticks; tick <= now_tick; ++tick)
+        {
+            std::vector<Timer>& slot = _slots[tick % _slots.size()];
+
+            for (size_t i = 0; i < slot.size();)
+            {
+                if (slot[i].deadline <= now)
+                {
+                    _timer_ticks.erase(slot[i].id);
+                    expired.push_back(std::move(slot[i]));
+                    std::swap(slot[i], slot.back());
+                    slot.pop_back();
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+        }
+
+        // The current tick is only partly over, so it's visited again next time
+        _next_tick = now_tick;
+    }
+
+    // Callbacks run without the lock so they can schedule the next timer
+    for (Timer& timer : expired)
+    {
+        timer.callback();
+    }
+}
+
+
+uint64_t TimerWheel::tick_for(Clock::time_point time) const
+{
+    return time <= _start ? 0 : (uint64_t)((time - _start) / _tick);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+
+// Hashed timing wheel shared by every session in a host. Timers are bucketed by the tick they fall in, so scheduling,
+// cancelling and expiring are constant time however many sessions are waiting. One thread calls advance()
+// regularly (the host's update loop) and it runs the callbacks that are due; timers can be scheduled and cancelled
+// from any thread.
+class TimerWheel
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    using Callback = std::function<void()>;
+
+    TimerWheel(Clock::duration tick = std::chrono::milliseconds(10), size_t num_slots = 256);
+
+    // Returns an id for cancel(), never 0
+    uint64_t schedule(Clock::time_point deadline, Callback callback);
+    void cancel(uint64_t id);
+
+    // Runs the callback of every timer with a deadline at or before now. Timers fire at most one tick late and
+    // never early.
+    void advance(Clock::time_point now);
+
+private:
+    struct Timer
+    {
+        uint64_t id;
+        Clock::time_point deadline;
+        Callback callback;
+    };
+
+    std::mutex _mutex;
+    Clock::duration _tick;
+    Clock::time_point _start;
+    uint64_t _next_tick{};          // First tick that advance() hasn't finished with
+    uint64_t _next_id = 1;
+    std::vector<std::vector<Timer>> _slots;
+    std::unordered_map<uint64_t, uint64_t> _timer_ticks; // Tick each pending timer is filed under
+
+    uint64_t tick_for(Clock::time_point time) const;
+};
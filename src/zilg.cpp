@@ -3,8 +3,11 @@
 
 #include "gli_file.h"
 #include "log.h"
+#include "scrollback.h"
+#include "timer_wheel.h"
 #include "zmachine.h"
 
+#include <chrono>
 #include <deque>
 #include <vector>
 
@@ -18,11 +21,12 @@ public:
             return false;
         }
 
-        if (!zm.load(story_data))
+        if (!zm.load(std::move(story_data)))
         {
             return false;
         }
 
+        zm.set_output_sink(OutputStream::Screen, &screen);
         return true;
     }
 
@@ -75,28 +79,44 @@ public:
 
     bool on_update(float delta) override
     {
+        timers.advance(TimerWheel::Clock::now());
         ZMachine::State state = zm.update();
 
-        // Process keyboard input
-        // TODO: Process keyboard events and send them directly to the machine
-        // The machine can handle building up the input line (will also make read_char easy)
+        // Timed input, the timer restarts each time the machine waits again after the interrupt routine
+        if (state == ZMachine::State::InputRequested && zm.input_timeout())
+        {
+            if (!input_timer)
+            {
+                std::chrono::milliseconds timeout(zm.input_timeout() * 100);
+                input_timer = timers.schedule(TimerWheel::Clock::now() + timeout, [this]() {
+                    input_timer = 0;
+                    zm.timer_expired();
+                });
+            }
+        }
+        else if (input_timer)
+        {
+            timers.cancel(input_timer);
+            input_timer = 0;
+        }
+
+        // Process keyboard input, keypresses go straight to the machine which edits the input line
         for (int i = 0; i < 256; ++i)
         {
             if (m_keys[i].pressed)
             {
                 if (i >= 0x20 && i <= 0x7F)
                 {
-                    input_buffer.push_back(i);
+                    zm.key((uint8_t)i);
                 }
-                else if (i == VK_BACK && !input_buffer.empty())
+                else if (i == VK_BACK)
                 {
-                    input_buffer.pop_back();
+                    zm.key(8);
                 }
                 else if (i == VK_RETURN)
                 {
-                    zm.input(input_buffer);
-                    logf("User input: %s\n", input_buffer.c_str());
-                    input_buffer.clear();
+                    logf("User input: %.*s\n", (int)zm.input_line().size(), zm.input_line().data());
+                    zm.key(13);
                 }
             }
         }
@@ -104,23 +124,22 @@ public:
         // Draw screen
         clear_screen(0);
 
-        // Draw as many lines as we can fit (bottom up), first the input buffer and then lines from the transcript.
-        std::vector<std::string>::const_reverse_iterator iter = zm.transcript().crbegin();
-        std::vector<std::string>::const_reverse_iterator end = zm.transcript().crend();
+        // Draw as many lines as we can fit (bottom up), first the input buffer and then lines from the scrollback.
+        size_t line = screen.end_line();
+        size_t first_line = screen.first_line();
         std::vector<std::string> display_lines;
 
         if (state == ZMachine::State::InputRequested)
         {
-            std::string input_line = *iter;
-            input_line += input_buffer;
+            std::string input_line(screen.line(--line));
+            input_line += zm.input_line();
             input_line += "_";
             wrap_line_to_display(input_line, display_lines, 80, 39);
-            ++iter;
         }
 
-        for (; iter != end && display_lines.size() < 39; ++iter)
+        for (; line > first_line && display_lines.size() < 39; --line)
         {
-            wrap_line_to_display(*iter, display_lines, 80, 39);
+            wrap_line_to_display(std::string(screen.line(line - 1)), display_lines, 80, 39);
         }
 
         int ypos = 8;
@@ -135,8 +154,10 @@ public:
 
     GliFileSystem fs;
     ZMachine zm;
+    ScrollbackStore screen;
     std::vector<uint8_t> story_data;
-    std::string input_buffer;
+    TimerWheel timers;
+    uint64_t input_timer = 0;
 };
 
 
@@ -1,8 +1,12 @@
 #include "zmachine.h"
 
+#include "blorb.h"
 #include "log.h"
+#include "shared_story.h"
+#include "task_pool.h"
 
 #include <algorithm>
+#include <cstring>
 #include <intrin.h>
 
 #define ZCHECK(_cond)                                      \
@@ -11,14 +15,6 @@
         if (!(_cond)) crash("Check failed: %s\n", #_cond); \
     } while (0)
 
-// clang-format off
-static const char* default_alphabet[3] = { 
-    "      abcdefghijklmnopqrstuvwxyz", 
-    "      ABCDEFGHIJKLMNOPQRSTUVWXYZ",
-    "       \n0123456789.,!?_#'\"/\\-:()"
-};
-// clang-format on
-
 
 static const ZMachine::InstructionHandlers instruction_handlers_3{
     { 0x01, &ZMachine::_je },
@@ -85,165 +81,1332 @@ static const ZMachine::InstructionHandlers instruction_handlers_3{
     { 0xE8, &ZMachine::_push },
     { 0xE9, &ZMachine::_pull },
     //{ 0xEA, &ZMachine::_split_window },
-    //{ 0xEB, &ZMachine::_set_window },
-    //{ 0xF3, &ZMachine::_output_stream },
+    { 0xEB, &ZMachine::_set_window },
+    { 0xF3, &ZMachine::_output_stream },
+    //{ 0xF4, &ZMachine::_input_stream },
+};
+
+
+static const ZMachine::InstructionMnemonics mnemonics_3{ { 0x01, "je" },
+                                                         { 0x02, "jl" },
+                                                         { 0x03, "jg" },
+                                                         { 0x04, "dec_chk" },
+                                                         { 0x05, "inc_chk" },
+                                                         { 0x06, "jin" },
+                                                         { 0x07, "test" },
+                                                         { 0x08, "or" },
+                                                         { 0x09, "and" },
+                                                         { 0x0A, "test_attr" },
+                                                         { 0x0B, "set_attr" },
+                                                         { 0x0C, "clear_attr" },
+                                                         { 0x0D, "store" },
+                                                         { 0x0E, "insert_obj" },
+                                                         { 0x0F, "loadw" },
+                                                         { 0x10, "loadb" },
+                                                         { 0x11, "get_prop" },
+                                                         { 0x12, "get_prop_addr" },
+                                                         { 0x13, "get_next_prop" },
+                                                         { 0x14, "add" },
+                                                         { 0x15, "sub" },
+                                                         { 0x16, "mul" },
+                                                         { 0x17, "div" },
+                                                         { 0x18, "mod" },
+                                                         { 0x80, "jz" },
+                                                         { 0x81, "get_sibling" },
+                                                         { 0x82, "get_child" },
+                                                         { 0x83, "get_parent" },
+                                                         { 0x84, "get_prop_len" },
+                                                         { 0x85, "inc" },
+                                                         { 0x86, "dec" },
+                                                         { 0x87, "print_addr" },
+                                                         { 0x89, "remove_obj" },
+                                                         { 0x8A, "print_obj" },
+                                                         { 0x8B, "ret" },
+                                                         { 0x8C, "jump" },
+                                                         { 0x8D, "print_paddr" },
+                                                         { 0x8E, "load" },
+                                                         { 0x8F, "not" },
+                                                         { 0xB0, "rtrue" },
+                                                         { 0xB1, "rfalse" },
+                                                         { 0xB2, "print" },
+                                                         { 0xB3, "print_ret" },
+                                                         { 0xB4, "nop" },
+                                                         { 0xB5, "save" },
+                                                         { 0xB6, "restore" },
+                                                         { 0xB7, "restart" },
+                                                         { 0xB8, "ret_popped" },
+                                                         { 0xB9, "pop" },
+                                                         { 0xBA, "quit" },
+                                                         { 0xBB, "new_line" },
+                                                         { 0xBC, "show_status" },
+                                                         { 0xBD, "verify" },
+                                                         { 0xE0, "call" },
+                                                         { 0xE1, "storew" },
+                                                         { 0xE2, "storeb" },
+                                                         { 0xE3, "put_prop" },
+                                                         { 0xE4, "sread" },
+                                                         { 0xE5, "print_char" },
+                                                         { 0xE6, "print_num" },
+                                                         { 0xE7, "random" },
+                                                         { 0xE8, "push" },
+                                                         { 0xE9, "pull" },
+                                                         { 0xEA, "split_window" },
+                                                         { 0xEB, "set_window" },
+                                                         { 0xF3, "output_stream" },
+                                                         { 0xF4, "input_stream" } };
+
+
+static const ZMachine::InstructionHandlers instruction_handlers_4{
+    { 0x01, &ZMachine::_je },
+    { 0x02, &ZMachine::_jl },
+    { 0x03, &ZMachine::_jg },
+    { 0x04, &ZMachine::_dec_chk },
+    { 0x05, &ZMachine::_inc_chk },
+    { 0x06, &ZMachine::_jin },
+    { 0x07, &ZMachine::_test },
+    { 0x08, &ZMachine::_or },
+    { 0x09, &ZMachine::_and },
+    { 0x0A, &ZMachine::_test_attr },
+    { 0x0B, &ZMachine::_set_attr },
+    { 0x0C, &ZMachine::_clear_attr },
+    { 0x0D, &ZMachine::_store },
+    { 0x0E, &ZMachine::_insert_obj },
+    { 0x0F, &ZMachine::_loadw },
+    { 0x10, &ZMachine::_loadb },
+    { 0x11, &ZMachine::_get_prop },
+    { 0x12, &ZMachine::_get_prop_addr },
+    { 0x13, &ZMachine::_get_next_prop },
+    { 0x14, &ZMachine::_add },
+    { 0x15, &ZMachine::_sub },
+    { 0x16, &ZMachine::_mul },
+    { 0x17, &ZMachine::_div },
+    { 0x18, &ZMachine::_mod },
+    { 0x19, &ZMachine::_call_2s_4 },
+    { 0x80, &ZMachine::_jz },
+    { 0x81, &ZMachine::_get_sibling },
+    { 0x82, &ZMachine::_get_child },
+    { 0x83, &ZMachine::_get_parent },
+    { 0x84, &ZMachine::_get_prop_len },
+    { 0x85, &ZMachine::_inc },
+    { 0x86, &ZMachine::_dec },
+    { 0x87, &ZMachine::_print_addr },
+    { 0x88, &ZMachine::_call_1s_4 },
+    { 0x89, &ZMachine::_remove_obj },
+    { 0x8A, &ZMachine::_print_obj },
+    { 0x8B, &ZMachine::_ret },
+    { 0x8C, &ZMachine::_jump },
+    { 0x8D, &ZMachine::_print_paddr },
+    { 0x8E, &ZMachine::_load },
+    { 0x8F, &ZMachine::_not },
+    { 0xB0, &ZMachine::_rtrue },
+    { 0xB1, &ZMachine::_rfalse },
+    { 0xB2, &ZMachine::_print },
+    { 0xB3, &ZMachine::_print_ret },
+    { 0xB4, &ZMachine::_nop },
+    //{ 0xB5, &ZMachine::_save },
+    //{ 0xB6, &ZMachine::_restore },
+    //{ 0xB7, &ZMachine::_restart },
+    { 0xB8, &ZMachine::_ret_popped },
+    { 0xB9, &ZMachine::_pop },
+    //{ 0xBA, &ZMachine::_quit },
+    { 0xBB, &ZMachine::_new_line },
+    //{ 0xBD, &ZMachine::_verify },
+    { 0xE0, &ZMachine::_call_vs_4 },
+    { 0xE1, &ZMachine::_storew },
+    { 0xE2, &ZMachine::_storeb },
+    { 0xE3, &ZMachine::_put_prop },
+    { 0xE4, &ZMachine::_sread_4 },
+    { 0xE5, &ZMachine::_print_char },
+    { 0xE6, &ZMachine::_print_num },
+    { 0xE7, &ZMachine::_random },
+    { 0xE8, &ZMachine::_push },
+    { 0xE9, &ZMachine::_pull },
+    { 0xEA, &ZMachine::_split_window },
+    { 0xEB, &ZMachine::_set_window },
+    { 0xEC, &ZMachine::_call_vs2_4 },
+    { 0xED, &ZMachine::_erase_window_4 },
+    { 0xEE, &ZMachine::_erase_line_4 },
+    { 0xEF, &ZMachine::_set_cursor_4 },
+    { 0xF0, &ZMachine::_get_cursor_4 },
+    { 0xF1, &ZMachine::_set_text_style_4 },
+    { 0xF2, &ZMachine::_buffer_mode_4 },
+    { 0xF3, &ZMachine::_output_stream },
     //{ 0xF4, &ZMachine::_input_stream },
+    { 0xF6, &ZMachine::_read_char_4 },
+    { 0xF7, &ZMachine::_scan_table_4 },
 };
 
 
-static const ZMachine::InstructionMnemonics mnemonics_3{ { 0x01, "je" },
-                                                         { 0x02, "jl" },
-                                                         { 0x03, "jg" },
-                                                         { 0x04, "dec_chk" },
-                                                         { 0x05, "inc_chk" },
-                                                         { 0x06, "jin" },
-                                                         { 0x07, "test" },
-                                                         { 0x08, "or" },
-                                                         { 0x09, "and" },
-                                                         { 0x0A, "test_attr" },
-                                                         { 0x0B, "set_attr" },
-                                                         { 0x0C, "clear_attr" },
-                                                         { 0x0D, "store" },
-                                                         { 0x0E, "insert_obj" },
-                                                         { 0x0F, "loadw" },
-                                                         { 0x10, "loadb" },
-                                                         { 0x11, "get_prop" },
-                                                         { 0x12, "get_prop_addr" },
-                                                         { 0x13, "get_next_prop" },
-                                                         { 0x14, "add" },
-                                                         { 0x15, "sub" },
-                                                         { 0x16, "mul" },
-                                                         { 0x17, "div" },
-                                                         { 0x18, "mod" },
-                                                         { 0x80, "jz" },
-                                                         { 0x81, "get_sibling" },
-                                                         { 0x82, "get_child" },
-                                                         { 0x83, "get_parent" },
-                                                         { 0x84, "get_prop_len" },
-                                                         { 0x85, "inc" },
-                                                         { 0x86, "dec" },
-                                                         { 0x87, "print_addr" },
-                                                         { 0x89, "remove_obj" },
-                                                         { 0x8A, "print_obj" },
-                                                         { 0x8B, "ret" },
-                                                         { 0x8C, "jump" },
-                                                         { 0x8D, "print_paddr" },
-                                                         { 0x8E, "load" },
-                                                         { 0x8F, "not" },
-                                                         { 0xB0, "rtrue" },
-                                                         { 0xB1, "rfalse" },
-                                                         { 0xB2, "print" },
-                                                         { 0xB3, "print_ret" },
-                                                         { 0xB4, "nop" },
-                                                         { 0xB5, "save" },
-                                                         { 0xB6, "restore" },
-                                                         { 0xB7, "restart" },
-                                                         { 0xB8, "ret_popped" },
-                                                         { 0xB9, "pop" },
-                                                         { 0xBA, "quit" },
-                                                         { 0xBB, "new_line" },
-                                                         { 0xBC, "show_status" },
-                                                         { 0xBD, "verify" },
-                                                         { 0xE0, "call" },
-                                                         { 0xE1, "storew" },
-                                                         { 0xE2, "storeb" },
-                                                         { 0xE3, "put_prop" },
-                                                         { 0xE4, "sread" },
-                                                         { 0xE5, "print_char" },
-                                                         { 0xE6, "print_num" },
-                                                         { 0xE7, "random" },
-                                                         { 0xE8, "push" },
-                                                         { 0xE9, "pull" },
-                                                         { 0xEA, "split_window" },
-                                                         { 0xEB, "set_window" },
-                                                         { 0xF3, "output_stream" },
-                                                         { 0xF4, "input_stream" } };
+static const ZMachine::InstructionMnemonics mnemonics_4{ { 0x01, "je" },
+                                                         { 0x02, "jl" },
+                                                         { 0x03, "jg" },
+                                                         { 0x04, "dec_chk" },
+                                                         { 0x05, "inc_chk" },
+                                                         { 0x06, "jin" },
+                                                         { 0x07, "test" },
+                                                         { 0x08, "or" },
+                                                         { 0x09, "and" },
+                                                         { 0x0A, "test_attr" },
+                                                         { 0x0B, "set_attr" },
+                                                         { 0x0C, "clear_attr" },
+                                                         { 0x0D, "store" },
+                                                         { 0x0E, "insert_obj" },
+                                                         { 0x0F, "loadw" },
+                                                         { 0x10, "loadb" },
+                                                         { 0x11, "get_prop" },
+                                                         { 0x12, "get_prop_addr" },
+                                                         { 0x13, "get_next_prop" },
+                                                         { 0x14, "add" },
+                                                         { 0x15, "sub" },
+                                                         { 0x16, "mul" },
+                                                         { 0x17, "div" },
+                                                         { 0x18, "mod" },
+                                                         { 0x19, "call_2s" },
+                                                         { 0x80, "jz" },
+                                                         { 0x81, "get_sibling" },
+                                                         { 0x82, "get_child" },
+                                                         { 0x83, "get_parent" },
+                                                         { 0x84, "get_prop_len" },
+                                                         { 0x85, "inc" },
+                                                         { 0x86, "dec" },
+                                                         { 0x87, "print_addr" },
+                                                         { 0x88, "call_1s" },
+                                                         { 0x89, "remove_obj" },
+                                                         { 0x8A, "print_obj" },
+                                                         { 0x8B, "ret" },
+                                                         { 0x8C, "jump" },
+                                                         { 0x8D, "print_paddr" },
+                                                         { 0x8E, "load" },
+                                                         { 0x8F, "not" },
+                                                         { 0xB0, "rtrue" },
+                                                         { 0xB1, "rfalse" },
+                                                         { 0xB2, "print" },
+                                                         { 0xB3, "print_ret" },
+                                                         { 0xB4, "nop" },
+                                                         { 0xB5, "save" },
+                                                         { 0xB6, "restore" },
+                                                         { 0xB7, "restart" },
+                                                         { 0xB8, "ret_popped" },
+                                                         { 0xB9, "pop" },
+                                                         { 0xBA, "quit" },
+                                                         { 0xBB, "new_line" },
+                                                         { 0xBD, "verify" },
+                                                         { 0xE0, "call_vs" },
+                                                         { 0xE1, "storew" },
+                                                         { 0xE2, "storeb" },
+                                                         { 0xE3, "put_prop" },
+                                                         { 0xE4, "sread" },
+                                                         { 0xE5, "print_char" },
+                                                         { 0xE6, "print_num" },
+                                                         { 0xE7, "random" },
+                                                         { 0xE8, "push" },
+                                                         { 0xE9, "pull" },
+                                                         { 0xEA, "split_window" },
+                                                         { 0xEB, "set_window" },
+                                                         { 0xEC, "call_vs2" },
+                                                         { 0xED, "erase_window" },
+                                                         { 0xEE, "erase_line" },
+                                                         { 0xEF, "set_cursor" },
+                                                         { 0xF0, "get_cursor" },
+                                                         { 0xF1, "set_text_style" },
+                                                         { 0xF2, "buffer_mode" },
+                                                         { 0xF3, "output_stream" },
+                                                         { 0xF4, "input_stream" },
+                                                         { 0xF6, "read_char" },
+                                                         { 0xF7, "scan_table" } };
+
+
+static const ZMachine::InstructionHandlers instruction_handlers_5{
+    { 0x01, &ZMachine::_je },
+    { 0x02, &ZMachine::_jl },
+    { 0x03, &ZMachine::_jg },
+    { 0x04, &ZMachine::_dec_chk },
+    { 0x05, &ZMachine::_inc_chk },
+    { 0x06, &ZMachine::_jin },
+    { 0x07, &ZMachine::_test },
+    { 0x08, &ZMachine::_or },
+    { 0x09, &ZMachine::_and },
+    { 0x0A, &ZMachine::_test_attr },
+    { 0x0B, &ZMachine::_set_attr },
+    { 0x0C, &ZMachine::_clear_attr },
+    { 0x0D, &ZMachine::_store },
+    { 0x0E, &ZMachine::_insert_obj },
+    { 0x0F, &ZMachine::_loadw },
+    { 0x10, &ZMachine::_loadb },
+    { 0x11, &ZMachine::_get_prop },
+    { 0x12, &ZMachine::_get_prop_addr },
+    { 0x13, &ZMachine::_get_next_prop },
+    { 0x14, &ZMachine::_add },
+    { 0x15, &ZMachine::_sub },
+    { 0x16, &ZMachine::_mul },
+    { 0x17, &ZMachine::_div },
+    { 0x18, &ZMachine::_mod },
+    { 0x19, &ZMachine::_call_2s_4 },
+    { 0x1A, &ZMachine::_call_2n_5 },
+    { 0x1B, &ZMachine::_set_colour_5 },
+    { 0x1C, &ZMachine::_throw_5 },
+    { 0x80, &ZMachine::_jz },
+    { 0x81, &ZMachine::_get_sibling },
+    { 0x82, &ZMachine::_get_child },
+    { 0x83, &ZMachine::_get_parent },
+    { 0x84, &ZMachine::_get_prop_len },
+    { 0x85, &ZMachine::_inc },
+    { 0x86, &ZMachine::_dec },
+    { 0x87, &ZMachine::_print_addr },
+    { 0x88, &ZMachine::_call_1s_4 },
+    { 0x89, &ZMachine::_remove_obj },
+    { 0x8A, &ZMachine::_print_obj },
+    { 0x8B, &ZMachine::_ret },
+    { 0x8C, &ZMachine::_jump },
+    { 0x8D, &ZMachine::_print_paddr },
+    { 0x8E, &ZMachine::_load },
+    { 0x8F, &ZMachine::_call_1n_5 },
+    { 0xB0, &ZMachine::_rtrue },
+    { 0xB1, &ZMachine::_rfalse },
+    { 0xB2, &ZMachine::_print },
+    { 0xB3, &ZMachine::_print_ret },
+    { 0xB4, &ZMachine::_nop },
+    //{ 0xB7, &ZMachine::_restart },
+    { 0xB8, &ZMachine::_ret_popped },
+    { 0xB9, &ZMachine::_catch_5 },
+    //{ 0xBA, &ZMachine::_quit },
+    { 0xBB, &ZMachine::_new_line },
+    //{ 0xBD, &ZMachine::_verify },
+    { 0xBF, &ZMachine::_piracy_5 },
+    { 0xE0, &ZMachine::_call_vs_4 },
+    { 0xE1, &ZMachine::_storew },
+    { 0xE2, &ZMachine::_storeb },
+    { 0xE3, &ZMachine::_put_prop },
+    { 0xE4, &ZMachine::_aread_5 },
+    { 0xE5, &ZMachine::_print_char },
+    { 0xE6, &ZMachine::_print_num },
+    { 0xE7, &ZMachine::_random },
+    { 0xE8, &ZMachine::_push },
+    { 0xE9, &ZMachine::_pull },
+    { 0xEA, &ZMachine::_split_window },
+    { 0xEB, &ZMachine::_set_window },
+    { 0xEC, &ZMachine::_call_vs2_4 },
+    { 0xED, &ZMachine::_erase_window_4 },
+    { 0xEE, &ZMachine::_erase_line_4 },
+    { 0xEF, &ZMachine::_set_cursor_4 },
+    { 0xF0, &ZMachine::_get_cursor_4 },
+    { 0xF1, &ZMachine::_set_text_style_4 },
+    { 0xF2, &ZMachine::_buffer_mode_4 },
+    { 0xF3, &ZMachine::_output_stream_5 },
+    //{ 0xF4, &ZMachine::_input_stream },
+    { 0xF5, &ZMachine::_sound_effect_5 },
+    { 0xF6, &ZMachine::_read_char_4 },
+    { 0xF7, &ZMachine::_scan_table_4 },
+    { 0xF8, &ZMachine::_not_5 },
+    { 0xF9, &ZMachine::_call_vn_5 },
+    { 0xFA, &ZMachine::_call_vn2_5 },
+    { 0xFB, &ZMachine::_tokenise_5 },
+    { 0xFC, &ZMachine::_encode_text_5 },
+    { 0xFD, &ZMachine::_copy_table_5 },
+    { 0xFE, &ZMachine::_print_table_5 },
+    { 0xFF, &ZMachine::_check_arg_count_5 },
+    { 0x0102, &ZMachine::_log_shift_5 },
+    { 0x0103, &ZMachine::_art_shift_5 },
+    { 0x0104, &ZMachine::_set_font_5 },
+    { 0x0109, &ZMachine::_save_undo_5 },
+    { 0x010A, &ZMachine::_restore_undo_5 },
+};
+
+
+static const ZMachine::InstructionMnemonics mnemonics_5{ { 0x01, "je" },
+                                                         { 0x02, "jl" },
+                                                         { 0x03, "jg" },
+                                                         { 0x04, "dec_chk" },
+                                                         { 0x05, "inc_chk" },
+                                                         { 0x06, "jin" },
+                                                         { 0x07, "test" },
+                                                         { 0x08, "or" },
+                                                         { 0x09, "and" },
+                                                         { 0x0A, "test_attr" },
+                                                         { 0x0B, "set_attr" },
+                                                         { 0x0C, "clear_attr" },
+                                                         { 0x0D, "store" },
+                                                         { 0x0E, "insert_obj" },
+                                                         { 0x0F, "loadw" },
+                                                         { 0x10, "loadb" },
+                                                         { 0x11, "get_prop" },
+                                                         { 0x12, "get_prop_addr" },
+                                                         { 0x13, "get_next_prop" },
+                                                         { 0x14, "add" },
+                                                         { 0x15, "sub" },
+                                                         { 0x16, "mul" },
+                                                         { 0x17, "div" },
+                                                         { 0x18, "mod" },
+                                                         { 0x19, "call_2s" },
+                                                         { 0x1A, "call_2n" },
+                                                         { 0x1B, "set_colour" },
+                                                         { 0x1C, "throw" },
+                                                         { 0x80, "jz" },
+                                                         { 0x81, "get_sibling" },
+                                                         { 0x82, "get_child" },
+                                                         { 0x83, "get_parent" },
+                                                         { 0x84, "get_prop_len" },
+                                                         { 0x85, "inc" },
+                                                         { 0x86, "dec" },
+                                                         { 0x87, "print_addr" },
+                                                         { 0x88, "call_1s" },
+                                                         { 0x89, "remove_obj" },
+                                                         { 0x8A, "print_obj" },
+                                                         { 0x8B, "ret" },
+                                                         { 0x8C, "jump" },
+                                                         { 0x8D, "print_paddr" },
+                                                         { 0x8E, "load" },
+                                                         { 0x8F, "call_1n" },
+                                                         { 0xB0, "rtrue" },
+                                                         { 0xB1, "rfalse" },
+                                                         { 0xB2, "print" },
+                                                         { 0xB3, "print_ret" },
+                                                         { 0xB4, "nop" },
+                                                         { 0xB7, "restart" },
+                                                         { 0xB8, "ret_popped" },
+                                                         { 0xB9, "catch" },
+                                                         { 0xBA, "quit" },
+                                                         { 0xBB, "new_line" },
+                                                         { 0xBD, "verify" },
+                                                         { 0xBF, "piracy" },
+                                                         { 0xE0, "call_vs" },
+                                                         { 0xE1, "storew" },
+                                                         { 0xE2, "storeb" },
+                                                         { 0xE3, "put_prop" },
+                                                         { 0xE4, "aread" },
+                                                         { 0xE5, "print_char" },
+                                                         { 0xE6, "print_num" },
+                                                         { 0xE7, "random" },
+                                                         { 0xE8, "push" },
+                                                         { 0xE9, "pull" },
+                                                         { 0xEA, "split_window" },
+                                                         { 0xEB, "set_window" },
+                                                         { 0xEC, "call_vs2" },
+                                                         { 0xED, "erase_window" },
+                                                         { 0xEE, "erase_line" },
+                                                         { 0xEF, "set_cursor" },
+                                                         { 0xF0, "get_cursor" },
+                                                         { 0xF1, "set_text_style" },
+                                                         { 0xF2, "buffer_mode" },
+                                                         { 0xF3, "output_stream" },
+                                                         { 0xF4, "input_stream" },
+                                                         { 0xF5, "sound_effect" },
+                                                         { 0xF6, "read_char" },
+                                                         { 0xF7, "scan_table" },
+                                                         { 0xF8, "not" },
+                                                         { 0xF9, "call_vn" },
+                                                         { 0xFA, "call_vn2" },
+                                                         { 0xFB, "tokenise" },
+                                                         { 0xFC, "encode_text" },
+                                                         { 0xFD, "copy_table" },
+                                                         { 0xFE, "print_table" },
+                                                         { 0xFF, "check_arg_count" },
+                                                         { 0x0102, "log_shift" },
+                                                         { 0x0103, "art_shift" },
+                                                         { 0x0104, "set_font" },
+                                                         { 0x0109, "save_undo" },
+                                                         { 0x010A, "restore_undo" } };
+
+
+static const ZMachine::ObjectTraits object_traits_3{
+    1, // Size of an object index in bytes
+    9, // Size of an object in bytes
+    4, // Number of bytes of attribute flags
+    31 // Maximum number of object properties
+};
+
+
+static const ZMachine::ObjectTraits object_traits_4{
+    2,  // Size of an object index in bytes
+    14, // Size of an object in bytes
+    6,  // Number of bytes of attribute flags
+    63  // Maximum number of object properties
+};
+
+
+static const ZMachine::Traits traits_3{ instruction_handlers_3, mnemonics_3, 2, 0, 2, object_traits_3 };
+static const ZMachine::Traits traits_4{ instruction_handlers_4, mnemonics_4, 4, 0, 3, object_traits_4 };
+static const ZMachine::Traits traits_5{ instruction_handlers_5, mnemonics_5, 4, 0, 3, object_traits_4 };
+
+
+// Headers of the story image sections ZMachine writes itself
+struct PropertyIndexImage
+{
+    uint32_t headers_base;
+    uint32_t headers_size;
+    uint32_t entry_count;
+    uint16_t indexed_objects;
+    uint16_t reserved;
+};
+
+struct PrevSiblingsImage
+{
+    uint32_t entries_base;
+    uint32_t entries_size;
+    uint16_t object_count;
+    uint16_t reserved;
+};
+
+
+static void swap_endian(ZMachineHeader& header)
+{
+    header.release_number = swap_endian(header.release_number);
+    header.high_mem_base = swap_endian(header.high_mem_base);
+    header.initial_pc = swap_endian(header.initial_pc);
+    header.dictionary_table = swap_endian(header.dictionary_table);
+    header.object_table = swap_endian(header.object_table);
+    header.globals_table = swap_endian(header.globals_table);
+    header.static_mem_base = swap_endian(header.static_mem_base);
+    header.game_flags = swap_endian(header.game_flags);
+    header.abbreviations_table = swap_endian(header.abbreviations_table);
+    header.file_length = swap_endian(header.file_length);
+    header.file_checksum = swap_endian(header.file_checksum);
+    header.screen_width_units = swap_endian(header.screen_width_units);
+    header.screen_height_units = swap_endian(header.screen_height_units);
+    header.routines_offset = swap_endian(header.routines_offset);
+    header.static_strings_offset = swap_endian(header.static_strings_offset);
+    header.terminating_characters_table = swap_endian(header.terminating_characters_table);
+    header.stream3_output_width = swap_endian(header.stream3_output_width);
+    header.standard_revision_number = swap_endian(header.standard_revision_number);
+    header.alphabet_table = swap_endian(header.alphabet_table);
+    header.extension_table = swap_endian(header.extension_table);
+}
+
+
+static uint32_t elapsed_us(std::chrono::steady_clock::time_point start)
+{
+    return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+static bool task_succeeded(const std::shared_future<void>& task)
+{
+    // Waits for a table build; one that threw counts as failed rather than throwing again here
+    if (!task.valid())
+    {
+        return true;
+    }
+
+    try
+    {
+        task.get();
+        return true;
+    }
+    catch (...)
+    {
+        return false;
+    }
+}
+
+
+ZMachine::~ZMachine()
+{
+    finish_tables();
+}
+
+
+bool ZMachine::load(std::vector<uint8_t>&& story_file)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    finish_tables();
+    _shared_story.reset();
+    _story_file.close();
+    _story_buffer = std::move(story_file);
+
+    if (!load_memory(_story_buffer.data(), _story_buffer.size(), start))
+    {
+        return unload();
+    }
+
+    return true;
+}
+
+
+bool ZMachine::load(const char* path)
+{
+    // Copy on write, so only the pages the story writes to (its dynamic memory) get private copies
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    finish_tables();
+    _shared_story.reset();
+    _story_buffer.clear();
+    _story_buffer.shrink_to_fit();
+
+    if (!_story_file.open(path, true) || !load_memory(_story_file.data(), _story_file.size(), start))
+    {
+        return unload();
+    }
+
+    return true;
+}
+
+
+bool ZMachine::load_shareable(const std::vector<uint8_t>& story_file)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    finish_tables();
+    _shared_story.reset();
+    _story_buffer.clear();
+    _story_buffer.shrink_to_fit();
+
+    if (!_story_file.create(story_file.data(), story_file.size()) || !load_memory(_story_file.data(), _story_file.size(), start))
+    {
+        return unload();
+    }
+
+    return true;
+}
+
+
+bool ZMachine::load(std::shared_ptr<const SharedStory> story)
+{
+    if (!story || !clone(story->machine()))
+    {
+        return false;
+    }
+
+    _shared_story = std::move(story);
+    return true;
+}
+
+
+bool ZMachine::unload()
+{
+    // After a failed load nothing of the previous story is left, its memory and the image its tables came from may
+    // be gone already. The machine stays crashed until a story loads.
+    _story_file.close();
+    _story_buffer.clear();
+    _story_buffer.shrink_to_fit();
+    _shared_story.reset();
+    _memory = nullptr;
+    _memory_size = 0;
+    _current_state = State::Crashed;
+    return false;
+}
+
+
+bool ZMachine::load_memory(uint8_t* memory, size_t size, std::chrono::steady_clock::time_point start)
+{
+    _memory = nullptr;
+    _memory_size = 0;
+    _load_times = LoadTimes{};
+    _tables_failed = false;
+
+    if (BlorbIndex::is_blorb(memory, size))
+    {
+        // The story is the executable chunk, used where it is in the Blorb file
+        BlorbIndex index;
+        const BlorbIndex::Resource* exec = index.parse(memory, size) ? index.find(BlorbIndex::Exec, 0) : nullptr;
+
+        if (!exec || exec->type != BlorbIndex::ZCOD)
+        {
+            logm("Blorb file has no Z-code\n");
+            return false;
+        }
+
+        memory += exec->offset;
+        size = exec->size;
+    }
+
+    StoryImage image;
+    bool from_image = StoryImage::is_image(memory, size);
+
+    if (from_image)
+    {
+        if (!image.open(memory, size))
+        {
+            return false;
+        }
+
+        memory = image.section(StoryImageSection::Story, size);
+
+        if (!memory)
+        {
+            logm("Story image has no story\n");
+            return false;
+        }
+    }
+
+    if (size > (size_t)std::numeric_limits<uint32_t>::max())
+    {
+        logm("Story file too large\n");
+        return false;
+    }
+
+    if (size < 64)
+    {
+        logm("Story file too small\n");
+        return false;
+    }
+
+    _memory = memory;
+    _memory_size = (uint32_t)size;
+
+    uint8_t version = _memory[0];
+
+    if (version == 3)
+    {
+        _traits = traits_3;
+    }
+    else if (version == 4)
+    {
+        _traits = traits_4;
+    }
+    else if (version == 5)
+    {
+        _traits = traits_5;
+    }
+    else
+    {
+        logf("Unsupported zmachine version %d\n", version);
+        return false;
+    }
+
+    // TODO - validate
+
+    reset();
+
+    std::chrono::steady_clock::time_point tables_start = std::chrono::steady_clock::now();
+    _load_times.memory = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(tables_start - start).count();
+
+    if (!from_image || !adopt_tables(image))
+    {
+        if (from_image)
+        {
+            logm("Story image tables don't match, rebuilding them\n");
+        }
+
+        if (!build_tables())
+        {
+            return false;
+        }
+    }
+
+    _load_times.tables = elapsed_us(tables_start);
+
+    // Snapshots share pages of dynamic memory and are encoded against it as loaded
+    std::chrono::steady_clock::time_point snapshot_start = std::chrono::steady_clock::now();
+    uint32_t dynamic_size = std::min<uint32_t>(_header.static_mem_base, _memory_size);
+    _initial_memory = std::make_shared<const std::vector<uint8_t>>(_memory, _memory + dynamic_size);
+    _snapshot_pages.assign((dynamic_size + snapshot_page_size - 1) / snapshot_page_size, nullptr);
+    _dirty_pages.assign((_memory_size + snapshot_page_size - 1) / snapshot_page_size, 1);
+    _load_times.snapshot = elapsed_us(snapshot_start);
+
+    // Scratch space used while running, sized up front so that turns don't allocate
+    _print_buffer.reserve(1024);
+    _input_queue.reserve(1024);
+    _key_queue.reserve(64);
+    _input_line.reserve(256);
+
+    _load_times.total = elapsed_us(start);
+    return true;
+}
+
+
+bool ZMachine::build_tables()
+{
+    // Alphabet and unicode translation tables are fixed for the life of the story. The alphabet is copied, a lazy
+    // build reads it once the story is running.
+    std::vector<uint8_t> alphabet_table;
+    std::vector<uint16_t> unicode_table;
+
+    if (_header.version >= 5)
+    {
+        if (_header.alphabet_table && (uint32_t)_header.alphabet_table + 78 <= _memory_size)
+        {
+            alphabet_table.assign(_memory + _header.alphabet_table, _memory + _header.alphabet_table + 78);
+        }
+
+        if (_header.extension_table && (uint32_t)_header.extension_table + 8 <= _memory_size &&
+            make_word(_memory[_header.extension_table], _memory[_header.extension_table + 1]) >= 3)
+        {
+            uint16_t unicode_table_addr = make_word(_memory[_header.extension_table + 6], _memory[_header.extension_table + 7]);
+
+            if (unicode_table_addr && unicode_table_addr < _memory_size)
+            {
+                uint8_t count = _memory[unicode_table_addr];
+
+                for (uint8_t i = 0; i < count && (uint32_t)unicode_table_addr + 2 + (i << 1) < _memory_size; ++i)
+                {
+                    uint32_t addr = unicode_table_addr + 1 + (i << 1);
+                    unicode_table.push_back(make_word(_memory[addr], _memory[addr + 1]));
+                }
+            }
+        }
+    }
+
+    // Each table is built from memory as loaded into members of its own, so the builds can run side by side
+    uint8_t version = _header.version;
+
+    TaskPool::Task codec = [this, version, alphabet_table, unicode_table]()
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        _codec.build(version, alphabet_table.empty() ? nullptr : alphabet_table.data(), unicode_table);
+        _load_times.codec = elapsed_us(start);
+    };
+
+    TaskPool::Task dictionary = [this]()
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        _dictionary_built = _dictionary.build(_memory, _memory_size, _header.dictionary_table, _traits.dictionary_word_length);
+        _load_times.dictionary = elapsed_us(start);
+    };
+
+    TaskPool::Task property_index = [this]()
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        build_property_index();
+        _load_times.property_index = elapsed_us(start);
+    };
+
+    TaskPool::Task prev_siblings = [this]()
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        build_prev_siblings();
+        _load_times.prev_siblings = elapsed_us(start);
+    };
+
+    _dictionary_writes_base = 0;
+    _dictionary_writes_size = 0;
+
+    if (_table_build == TableBuild::Lazy)
+    {
+        /*
+            Once the story runs it writes dynamic memory, so only tables read from elsewhere are left to finish in the
+            background: the codec, and the dictionary when it's in static memory. The property index and sibling links
+            come from the object table, which is dynamic; reset() left them dirty so they're built on first use.
+        */
+        _property_headers_size = 0;
+        _object_entries_size = 0;
+        _pending_codec = TaskPool::shared().submit(std::move(codec)).share();
+
+        if (_header.dictionary_table >= _header.static_mem_base)
+        {
+            _pending_dictionary = TaskPool::shared().submit(std::move(dictionary)).share();
+        }
+        else
+        {
+            dictionary();
+        }
+
+        _tables_pending = true;
+        return true;
+    }
+
+    if (_table_build == TableBuild::Parallel)
+    {
+        // The codec's word table is by far the largest, so it's split into parts of its own and the loading thread
+        // builds one of them rather than sit idle
+        static constexpr uint32_t word_parts = 4;
+        uint32_t word_part_times[word_parts]{};
+        std::vector<std::shared_future<void>> tasks;
+        bool built = true;
+        std::chrono::steady_clock::time_point codec_start = std::chrono::steady_clock::now();
+        _codec.build(version, alphabet_table.empty() ? nullptr : alphabet_table.data(), unicode_table, false);
+        uint32_t codec_time = elapsed_us(codec_start);
+
+        tasks.push_back(TaskPool::shared().submit(std::move(dictionary)).share());
+        tasks.push_back(TaskPool::shared().submit(std::move(property_index)).share());
+        tasks.push_back(TaskPool::shared().submit(std::move(prev_siblings)).share());
+
+        for (uint32_t part = 0; part < word_parts; ++part)
+        {
+            TaskPool::Task words = [this, part, &word_part_times]()
+            {
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                uint32_t part_size = ZsciiCodec::word_count / word_parts;
+                _codec.build_words(part * part_size, (part + 1) * part_size);
+                word_part_times[part] = elapsed_us(start);
+            };
+
+            if (part + 1 < word_parts)
+            {
+                tasks.push_back(TaskPool::shared().submit(std::move(words)).share());
+            }
+            else
+            {
+                try
+                {
+                    words();
+                }
+                catch (...)
+                {
+                    built = false;
+                }
+            }
+        }
+
+        // Every task finishes before the locals they use go, whether or not another one failed
+        for (const std::shared_future<void>& task : tasks)
+        {
+            built = task_succeeded(task) && built;
+        }
+
+        if (!built)
+        {
+            logm("Failed to build the story's tables\n");
+            return false;
+        }
+
+        for (uint32_t time : word_part_times)
+        {
+            codec_time += time;
+        }
+
+        _load_times.codec = codec_time;
+    }
+    else
+    {
+        codec();
+        dictionary();
+        property_index();
+        prev_siblings();
+    }
+
+    if (!_dictionary_built)
+    {
+        logm("Failed to build dictionary index\n");
+        return false;
+    }
+
+    watch_dictionary(_dictionary);
+    return true;
+}
+
+
+void ZMachine::finish_tables()
+{
+    if (!_tables_pending)
+    {
+        return;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool built = task_succeeded(_pending_codec);
+    built = task_succeeded(_pending_dictionary) && built;
+
+    _pending_codec = std::shared_future<void>();
+    _pending_dictionary = std::shared_future<void>();
+    _tables_pending = false;
+    _load_times.lazy_wait += elapsed_us(start);
+
+    // Called from the destructor and between instructions too, so a failure is left for update() to report
+    if (!built || !_dictionary_built)
+    {
+        logm("Failed to build the story's tables\n");
+        _tables_failed = true;
+        return;
+    }
+
+    watch_dictionary(_dictionary);
+}
+
+
+const ZMachine::LoadTimes& ZMachine::load_times()
+{
+    finish_tables();
+    return _load_times;
+}
+
+
+bool ZMachine::adopt_tables(const StoryImage& image)
+{
+    size_t size = 0;
+    const uint8_t* codec = image.section(StoryImageSection::Codec, size);
+
+    if (!codec || !_codec.adopt(codec, size))
+    {
+        return false;
+    }
+
+    const uint8_t* dictionary = image.section(StoryImageSection::Dictionary, size);
+
+    if (!dictionary || !_dictionary.adopt(dictionary, size) || _dictionary.addr() != _header.dictionary_table)
+    {
+        return false;
+    }
+
+    /*
+        Property index section:
+        PropertyIndexImage
+        entry_count PropertyIndexEntry
+        header bits, one per address from headers_base
+    */
+    const uint8_t* property_index = image.section(StoryImageSection::PropertyIndex, size);
+    PropertyIndexImage index_header;
+
+    if (!property_index || size < sizeof(index_header))
+    {
+        return false;
+    }
+
+    memcpy(&index_header, property_index, sizeof(index_header));
+    size_t entries_size = index_header.entry_count * sizeof(PropertyIndexEntry);
+
+    if (size != sizeof(index_header) + entries_size + ((index_header.headers_size + 7) >> 3) ||
+        index_header.entry_count != (index_header.indexed_objects + 1u) * (_traits.object_traits.max_properties + 1u))
+    {
+        return false;
+    }
+
+    // Previous sibling links change as the story runs, so they are copied
+    const uint8_t* prev_siblings = image.section(StoryImageSection::PrevSiblings, size);
+    PrevSiblingsImage siblings_header;
+
+    if (!prev_siblings || size < sizeof(siblings_header))
+    {
+        return false;
+    }
+
+    memcpy(&siblings_header, prev_siblings, sizeof(siblings_header));
+
+    if (size != sizeof(siblings_header) + (siblings_header.object_count + 1u) * sizeof(uint16_t))
+    {
+        return false;
+    }
 
+    _property_index.clear();
+    _property_index.shrink_to_fit();
+    _property_headers.clear();
+    _property_headers.shrink_to_fit();
+    _property_entries = (const PropertyIndexEntry*)(property_index + sizeof(index_header));
+    _property_header_bits = property_index + sizeof(index_header) + entries_size;
+    _property_headers_base = index_header.headers_base;
+    _property_headers_size = index_header.headers_size;
+    _indexed_objects = index_header.indexed_objects;
+    _property_index_dirty = false;
+
+    _object_entries_base = siblings_header.entries_base;
+    _object_entries_size = siblings_header.entries_size;
+    _object_count = siblings_header.object_count;
+    _prev_sibling.resize(_object_count + 1);
+    memcpy(_prev_sibling.data(), prev_siblings + sizeof(siblings_header), _prev_sibling.size() * sizeof(uint16_t));
+    _prev_sibling_dirty = false;
+
+    _dictionary_built = true;
+    watch_dictionary(_dictionary);
+    return true;
+}
 
-static const ZMachine::ObjectTraits object_traits_3{
-    1, // Size of an object index in bytes
-    9, // Size of an object in bytes
-    4, // Number of bytes of attribute flags
-    31 // Maximum number of object properties
-};
 
+bool ZMachine::save_image(const char* path)
+{
+    StoryImageWriter writer;
+    return add_image_sections(writer) && writer.write(path);
+}
 
-static const ZMachine::Traits traits_3{ instruction_handlers_3, mnemonics_3, 2, 0, 2, object_traits_3 };
 
+bool ZMachine::save_image(std::vector<uint8_t>& image, bool with_story)
+{
+    StoryImageWriter writer;
+    return add_image_sections(writer) && writer.build(image, with_story);
+}
 
-static void swap_endian(ZMachineHeader& header)
+
+bool ZMachine::use_image_tables(const StoryImage& image)
 {
-    header.release_number = swap_endian(header.release_number);
-    header.high_mem_base = swap_endian(header.high_mem_base);
-    header.initial_pc = swap_endian(header.initial_pc);
-    header.dictionary_table = swap_endian(header.dictionary_table);
-    header.object_table = swap_endian(header.object_table);
-    header.globals_table = swap_endian(header.globals_table);
-    header.static_mem_base = swap_endian(header.static_mem_base);
-    header.game_flags = swap_endian(header.game_flags);
-    header.abbreviations_table = swap_endian(header.abbreviations_table);
-    header.file_length = swap_endian(header.file_length);
-    header.file_checksum = swap_endian(header.file_checksum);
-    header.screen_width_units = swap_endian(header.screen_width_units);
-    header.screen_height_units = swap_endian(header.screen_height_units);
-    header.routines_offset = swap_endian(header.routines_offset);
-    header.static_strings_offset = swap_endian(header.static_strings_offset);
-    header.terminating_characters_table = swap_endian(header.terminating_characters_table);
-    header.stream3_output_width = swap_endian(header.stream3_output_width);
-    header.standard_revision_number = swap_endian(header.standard_revision_number);
-    header.alphabet_table = swap_endian(header.alphabet_table);
-    header.extension_table = swap_endian(header.extension_table);
+    finish_tables();
+
+    if (!_memory || !image.matches(_memory, _memory_size))
+    {
+        logm("ZMachine::use_image_tables: Image is of another story\n");
+        return false;
+    }
+
+    if (!adopt_tables(image))
+    {
+        logm("ZMachine::use_image_tables: Image tables don't match, rebuilding them\n");
+        build_tables();
+        return false;
+    }
+
+    return true;
 }
 
 
-ZMachine::~ZMachine()
+bool ZMachine::add_image_sections(StoryImageWriter& writer)
 {
-    delete[] _memory;
+    finish_tables();
+
+    if (!_memory)
+    {
+        logm("ZMachine::save_image: No story loaded\n");
+        return false;
+    }
+
+    if (_property_index_dirty)
+    {
+        build_property_index();
+    }
+
+    if (_prev_sibling_dirty)
+    {
+        build_prev_siblings();
+    }
+
+    std::vector<uint8_t> data;
+    writer.add_section(StoryImageSection::Story, _memory, _memory_size);
+
+    _codec.serialize(data);
+    writer.add_section(StoryImageSection::Codec, data.data(), data.size());
+
+    _dictionary.serialize(data);
+    writer.add_section(StoryImageSection::Dictionary, data.data(), data.size());
+
+    uint32_t entry_count = (_indexed_objects + 1u) * (_traits.object_traits.max_properties + 1u);
+    size_t entries_size = entry_count * sizeof(PropertyIndexEntry);
+    PropertyIndexImage index_header{ _property_headers_base, _property_headers_size, entry_count, _indexed_objects, 0 };
+    data.assign(sizeof(index_header) + entries_size + ((_property_headers_size + 7) >> 3), 0);
+    memcpy(data.data(), &index_header, sizeof(index_header));
+    memcpy(data.data() + sizeof(index_header), _property_entries, entries_size);
+    memcpy(data.data() + sizeof(index_header) + entries_size, _property_header_bits, (_property_headers_size + 7) >> 3);
+    writer.add_section(StoryImageSection::PropertyIndex, data.data(), data.size());
+
+    PrevSiblingsImage siblings_header{ _object_entries_base, _object_entries_size, _object_count, 0 };
+    data.assign(sizeof(siblings_header) + _prev_sibling.size() * sizeof(uint16_t), 0);
+    memcpy(data.data(), &siblings_header, sizeof(siblings_header));
+    memcpy(data.data() + sizeof(siblings_header), _prev_sibling.data(), _prev_sibling.size() * sizeof(uint16_t));
+    writer.add_section(StoryImageSection::PrevSiblings, data.data(), data.size());
+    return true;
 }
 
 
-bool ZMachine::load(std::vector<uint8_t>& story_file)
+bool ZMachine::clone(const ZMachine& source)
 {
-    if (story_file.size() > (size_t)std::numeric_limits<uint32_t>::max)
+    if (!source._memory)
     {
-        logm("Story file too large\n");
+        logm("ZMachine::clone: No story loaded\n");
         return false;
     }
 
-    _memory_size = (uint32_t)story_file.size();
-    _memory = new uint8_t[_memory_size];
-    memcpy(_memory, story_file.data(), _memory_size);
+    finish_tables();
 
-    uint8_t version = story_file[0];
+    // A lazy load of the source may still be building its codec and dictionary. Each clone waits on copies of the
+    // source's futures, so clones can be made from several threads at once.
+    std::shared_future<void> source_codec = source._pending_codec;
+    std::shared_future<void> source_dictionary = source._pending_dictionary;
 
-    if (version == 3)
+    if (!task_succeeded(source_codec) || !task_succeeded(source_dictionary) || !source._dictionary_built)
     {
-        _traits = traits_3;
+        logm("ZMachine::clone: Source's tables failed to build\n");
+        return false;
+    }
+
+    if (source._story_file.data())
+    {
+        _story_buffer.clear();
+        _story_buffer.shrink_to_fit();
+
+        if (!_story_file.copy_view(source._story_file))
+        {
+            return unload();
+        }
+
+        _memory = _story_file.data() + (source._memory - source._story_file.data());
+        memcpy(_memory, source._memory, std::min<uint32_t>(source._header.static_mem_base, source._memory_size));
     }
     else
     {
-        logf("Unsupported zmachine version %d\n", version);
+        _story_file.close();
+        _story_buffer = source._story_buffer;
+        _memory = _story_buffer.data() + (source._memory - source._story_buffer.data());
+    }
+
+    _shared_story = source._shared_story;
+    _memory_size = source._memory_size;
+    _traits = source._traits;
+    _header = source._header;
+    _codec = source._codec;
+    _pc = source._pc;
+    _sp = source._sp;
+    _locals_base = source._locals_base;
+    memcpy(_stack + _sp, source._stack + _sp, (sizeof(_stack) / sizeof(_stack[0]) - _sp) * sizeof(_stack[0]));
+    _current_state = source._current_state;
+
+    _suspended_instruction = source._suspended_instruction;
+    _suspended_handler = source._suspended_handler;
+    _input_timeout = source._input_timeout;
+    _input_routine = source._input_routine;
+    _timer_pending = source._timer_pending;
+    _interrupt_frame = source._interrupt_frame;
+    _interrupt_result = source._interrupt_result;
+    _interrupt_returned = source._interrupt_returned;
+    _input_queue = source._input_queue;
+    _key_queue = source._key_queue;
+    _input_line = source._input_line;
+    _rng.set_state(source._rng.state());
+    _initial_memory = source._initial_memory;
+    _snapshot_pages = source._snapshot_pages;
+    _dirty_pages = source._dirty_pages;
+
+    // Index pointers either follow the vectors into this machine or stay on the source's story image
+    _property_index = source._property_index;
+    _property_headers = source._property_headers;
+    _property_header_addrs = source._property_header_addrs;
+    bool own_property_index = source._property_entries == source._property_index.data();
+    _property_entries = own_property_index ? _property_index.data() : source._property_entries;
+    _property_header_bits = own_property_index ? _property_headers.data() : source._property_header_bits;
+    _property_headers_base = source._property_headers_base;
+    _property_headers_size = source._property_headers_size;
+    _indexed_objects = source._indexed_objects;
+    _property_index_dirty = source._property_index_dirty;
+
+    _dictionary = source._dictionary;
+    _user_dictionaries = source._user_dictionaries;
+    _dictionary_writes_base = source._dictionary_writes_base;
+    _dictionary_writes_size = source._dictionary_writes_size;
+    _dictionaries_dirty = source._dictionaries_dirty;
+    _dictionary_built = true;
+    _tables_failed = false;
+
+    // A source still loading lazily hasn't watched its dictionary yet
+    watch_dictionary(_dictionary);
+
+    _prev_sibling = source._prev_sibling;
+    _object_entries_base = source._object_entries_base;
+    _object_entries_size = source._object_entries_size;
+    _object_count = source._object_count;
+    _prev_sibling_dirty = source._prev_sibling_dirty;
+
+    for (OutputSink*& sink : _output_sinks)
+    {
+        sink = nullptr;
+    }
+
+    _screen_selected = source._screen_selected;
+    _command_script_selected = source._command_script_selected;
+    memcpy(_memory_streams, source._memory_streams, sizeof(_memory_streams));
+    _memory_stream_depth = source._memory_stream_depth;
+    _window = source._window;
+    _text_style = source._text_style;
+
+    _print_buffer.reserve(1024);
+    _input_queue.reserve(1024);
+    _key_queue.reserve(64);
+    _input_line.reserve(256);
+    return true;
+}
+
+
+bool ZMachine::snapshot(Snapshot& snapshot)
+{
+    if (_current_state != State::InputRequested || _interrupt_frame || _memory_stream_depth)
+    {
+        logm("ZMachine::snapshot: Not waiting for input\n");
         return false;
     }
 
-    // TODO - validate
+    // Only pages written since the last snapshot are copied, the rest are shared with it
+    uint32_t dynamic_size = (uint32_t)_initial_memory->size();
 
-    reset();
+    for (size_t page = 0; page < _snapshot_pages.size(); ++page)
+    {
+        if (_dirty_pages[page] || !_snapshot_pages[page])
+        {
+            std::shared_ptr<SnapshotPage> copy = std::make_shared<SnapshotPage>();
+            uint32_t offset = (uint32_t)page * snapshot_page_size;
+            uint32_t size = std::min(snapshot_page_size, dynamic_size - offset);
+            memcpy(copy->bytes, _memory + offset, size);
+            memset(copy->bytes + size, 0, snapshot_page_size - size);
+            _snapshot_pages[page] = std::move(copy);
+            _dirty_pages[page] = 0;
+        }
+    }
 
+    snapshot.release_number = _header.release_number;
+    memcpy(snapshot.serial, _header.serial, sizeof(snapshot.serial));
+    snapshot.checksum = _header.file_checksum;
+    snapshot.memory_size = dynamic_size;
+    snapshot.pages = _snapshot_pages;
+    snapshot.initial_memory = _initial_memory;
+    snapshot.stack.assign(_stack + _sp, _stack + sizeof(_stack) / sizeof(_stack[0]));
+    snapshot.pc = _pc;
+    snapshot.sp = _sp;
+    snapshot.locals_base = _locals_base;
+    snapshot.instruction = _suspended_instruction;
+    snapshot.input_timeout = _input_timeout;
+    snapshot.input_routine = _input_routine;
+    snapshot.window = _window;
+    snapshot.text_style = _text_style;
+    snapshot.random = _rng.state();
+    return true;
+}
+
+
+bool ZMachine::restore(const Snapshot& snapshot)
+{
+    if (!_memory || snapshot.release_number != _header.release_number || memcmp(snapshot.serial, _header.serial, sizeof(snapshot.serial)) ||
+        snapshot.checksum != _header.file_checksum || snapshot.memory_size != _initial_memory->size() ||
+        snapshot.pages.size() != _snapshot_pages.size())
+    {
+        logm("ZMachine::restore: Snapshot is of a different story\n");
+        return false;
+    }
+
+    InstructionHandlers::const_iterator handler = _traits.instruction_handlers.find(snapshot.instruction.opcode);
+
+    if (handler == _traits.instruction_handlers.end() || snapshot.stack.size() != sizeof(_stack) / sizeof(_stack[0]) - snapshot.sp)
+    {
+        logm("ZMachine::restore: Bad snapshot\n");
+        return false;
+    }
+
+    for (size_t page = 0; page < snapshot.pages.size(); ++page)
+    {
+        uint32_t offset = (uint32_t)page * snapshot_page_size;
+        memcpy(_memory + offset, snapshot.pages[page]->bytes, std::min(snapshot_page_size, snapshot.memory_size - offset));
+        _dirty_pages[page] = 0;
+    }
+
+    _snapshot_pages = snapshot.pages;
+    _sp = snapshot.sp;
+    memcpy(_stack + _sp, snapshot.stack.data(), snapshot.stack.size() * sizeof(_stack[0]));
+    _pc = snapshot.pc;
+    _locals_base = snapshot.locals_base;
+    _suspended_instruction = snapshot.instruction;
+    _suspended_handler = handler->second;
+    _input_timeout = snapshot.input_timeout;
+    _input_routine = snapshot.input_routine;
+    _timer_pending = false;
+    _interrupt_frame = 0;
+    _interrupt_returned = false;
+    _input_queue.clear();
+    _key_queue.clear();
+    _input_line.clear();
+    _window = snapshot.window;
+    _text_style = snapshot.text_style;
+    _rng.set_state(snapshot.random);
+
+    // Everything derived from dynamic memory has to be rebuilt
+    _property_index_dirty = true;
+    _prev_sibling_dirty = true;
+    _dictionaries_dirty = true;
+
+    // Like reset, restoring also recovers a crashed machine
+    _current_state = State::InputRequested;
     return true;
 }
 
 
 void ZMachine::reset()
 {
+    if (_memory[0] >= 4)
+    {
+        _memory[0x01] |= InterpreterFlags::TimedInputSupported;
+    }
+
     memcpy(&_header, _memory, sizeof(ZMachineHeader));
     swap_endian(_header);
 
     // TODO: Flags
 
+    _property_index_dirty = true;
+    _prev_sibling_dirty = true;
+
     _pc = _header.initial_pc;
     _sp = 0xFFFF;
     _locals_base = _sp;
+    _interrupt_frame = 0;
+    _timer_pending = false;
 
     _current_state = State::Running;
 }
@@ -251,15 +1414,44 @@ void ZMachine::reset()
 
 ZMachine::State ZMachine::update()
 {
+    if (_tables_failed)
+    {
+        set_state(State::Crashed);
+    }
+
     if (_current_state == State::Crashed)
     {
         return _current_state;
     }
 
+#if defined(ZILG_COUNT_ALLOCATIONS)
+    uint64_t allocations = allocation_count();
+    _sink_allocations = 0;
+#endif
+
     if (_current_state == State::InputRequested)
     {
-        _pc = _resume_pc;
+        // Continue the instruction that asked for input. Its operands were decoded (and any stack operands popped)
+        // before it suspended, and _pc is still just past them. If its timer has expired the interrupt routine runs
+        // first and ret() continues the instruction when it returns.
         set_state(State::Running);
+
+        try
+        {
+            if (_timer_pending && _input_routine)
+            {
+                _timer_pending = false;
+                call_interrupt(_input_routine);
+            }
+            else
+            {
+                (this->*_suspended_handler)(_suspended_instruction);
+            }
+        }
+        catch (State s)
+        {
+            set_state(s);
+        }
     }
 
     while (_current_state == State::Running)
@@ -267,13 +1459,21 @@ ZMachine::State ZMachine::update()
         try
         {
             ZInstruction instruction{};
-            _resume_pc = _pc;
             uint8_t opcode = read(_pc++);
 
             if (opcode == 0xBE)
             {
-                // TODO: EXTOP
-                crash("EXTOP instructions not supported\n");
+                // 0xBE - EXTOP (1 0 1 1 1 1 1 0), then the opcode and a byte of operand types
+                instruction.opcode = 0x100 | read(_pc++);
+
+                uint8_t operands = read(_pc++);
+
+                for (int o = 0; (o < 4) && ((operands & 0xC0) != 0xC0); ++o)
+                {
+                    instruction.operand_types[instruction.operand_count] = operands >> 6;
+                    instruction.operand_count++;
+                    operands <<= 2;
+                }
             }
             else if (opcode < 0x80)
             {
@@ -372,15 +1572,99 @@ ZMachine::State ZMachine::update()
         }
     }
 
-    flush_line();
+    // Tables a lazy load left building are waited for by the first instruction that needs them
+    if (_tables_failed)
+    {
+        set_state(State::Crashed);
+    }
+
+#if defined(ZILG_COUNT_ALLOCATIONS)
+    _update_allocations = allocation_count() - allocations - _sink_allocations;
+#endif
 
     return _current_state;
 }
 
 
-void ZMachine::input(const std::string& user_input)
+void ZMachine::input(std::string_view user_input)
+{
+    // Line breaks separate queued lines, so cut the input at the first one
+    _input_queue.append(user_input.substr(0, user_input.find('\n')));
+    _input_queue.push_back('\n');
+}
+
+
+void ZMachine::set_output_sink(OutputStream::Type stream, OutputSink* sink)
+{
+    if (stream >= OutputStream::Screen && stream < OutputStream::Count && stream != OutputStream::Memory)
+    {
+        _output_sinks[stream] = sink;
+    }
+}
+
+
+void ZMachine::key(uint8_t zscii)
+{
+    _key_queue.push_back((char)zscii);
+}
+
+
+uint16_t ZMachine::input_timeout() const
 {
-    _user_input.push_back(user_input);
+    return (_current_state == State::InputRequested && _input_routine) ? _input_timeout : 0;
+}
+
+
+void ZMachine::timer_expired()
+{
+    _timer_pending = input_timeout() != 0;
+}
+
+
+bool ZMachine::output_discarded() const
+{
+    if (_memory_stream_depth)
+    {
+        return false;
+    }
+
+    if (_screen_selected && _output_sinks[OutputStream::Screen])
+    {
+        return false;
+    }
+
+    bool transcripting = (_memory[0x11] & GameFlags::Transcripting) != 0;
+    return !(transcripting && _window == 0 && _output_sinks[OutputStream::Transcript]);
+}
+
+
+void ZMachine::print(std::string_view text)
+{
+    if (text.empty())
+    {
+        return;
+    }
+
+    if (_memory_stream_depth)
+    {
+        // While stream 3 is selected no text goes to any other stream
+        write_memory_stream(text);
+        return;
+    }
+
+    if (_screen_selected)
+    {
+        write_sink(OutputStream::Screen, text);
+    }
+
+    // Stream 2 is selected by the transcripting bit in Flags 2, which the story may set directly. Only the lower
+    // window is transcribed.
+    bool transcripting = (_memory[0x11] & GameFlags::Transcripting) != 0;
+
+    if (transcripting && _window == 0)
+    {
+        write_sink(OutputStream::Transcript, text);
+    }
 }
 
 
@@ -394,6 +1678,38 @@ uint8_t ZMachine::read(uint32_t addr)
 void ZMachine::write(uint32_t addr, uint8_t byte)
 {
     ZCHECK(addr < _memory_size);
+
+    if (_memory[addr] != byte)
+    {
+        _dirty_pages[addr / snapshot_page_size] = 1;
+        uint32_t header_bit = addr - _property_headers_base;
+
+        if (header_bit < _property_headers_size && (_property_header_bits[header_bit >> 3] & (1 << (header_bit & 7))))
+        {
+            // Story is rewriting the layout of a property table
+            _property_index_dirty = true;
+        }
+
+        if (addr - _dictionary_writes_base < _dictionary_writes_size)
+        {
+            // Story is modifying a dictionary in dynamic memory
+            _dictionaries_dirty = true;
+        }
+
+        if (addr - _object_entries_base < _object_entries_size)
+        {
+            // Story is poking the object table directly, shadow links need rebuilding if it touched a sibling link
+            const ObjectTraits& traits = _traits.object_traits;
+            uint8_t field = (addr - _object_entries_base) % traits.object_size_bytes;
+            uint8_t sibling_field = traits.attribute_flag_bytes + traits.object_index_size_bytes;
+
+            if (field >= sibling_field && field < sibling_field + traits.object_index_size_bytes)
+            {
+                _prev_sibling_dirty = true;
+            }
+        }
+    }
+
     _memory[addr] = byte;
 }
 
@@ -410,8 +1726,8 @@ uint16_t ZMachine::readw(uint32_t addr)
 void ZMachine::writew(uint32_t addr, uint16_t word)
 {
     ZCHECK(addr < _memory_size - 1);
-    _memory[addr] = hi(word);
-    _memory[addr + 1] = lo(word);
+    write(addr, hi(word));
+    write(addr + 1, lo(word));
 }
 
 
@@ -439,9 +1755,11 @@ void ZMachine::write_tablew(uint32_t addr, uint16_t index, uint16_t word)
 }
 
 
-uint16_t ZMachine::read_string(uint32_t addr, std::vector<char>& str, bool terminate)
+uint16_t ZMachine::read_string(uint32_t addr, std::string& str)
 {
-    uint16_t triplet = 0;
+    finish_tables();
+
+    uint16_t word = 0;
     uint16_t len = 0;
     uint8_t decoder_mode = 0;
     uint16_t zscii_code = 0;
@@ -454,16 +1772,28 @@ uint16_t ZMachine::read_string(uint32_t addr, std::vector<char>& str, bool termi
         7     - raw ZSCII low
     */
 
-    for (; (triplet & 0x8000) == 0;)
+    for (; (word & 0x8000) == 0;)
     {
-        triplet = readw(addr);
+        word = readw(addr);
         addr += 2;
         len += 2;
 
+        if (decoder_mode == 0)
+        {
+            // Fast path: most words are three plain characters
+            const ZsciiCodec::DecodedWord& decoded = _codec.decode_word(word);
+
+            if (decoded.length != ZsciiCodec::slow_path)
+            {
+                str.append(decoded.text, decoded.length);
+                continue;
+            }
+        }
+
         // Unpack triple
         for (int shift = 10; shift >= 0; shift -= 5)
         {
-            char c = (triplet >> shift) & 0x1F;
+            uint8_t c = (word >> shift) & 0x1F;
 
             if (decoder_mode < 3)
             {
@@ -481,7 +1811,8 @@ uint16_t ZMachine::read_string(uint32_t addr, std::vector<char>& str, bool termi
                 }
                 else
                 {
-                    str.push_back(c ? default_alphabet[decoder_mode][c] : ' ');
+                    const ZsciiCodec::Utf8& utf8 = _codec.decode(decoder_mode, c);
+                    str.append(utf8.bytes, utf8.length);
                     decoder_mode = 0;
                 }
             }
@@ -490,7 +1821,7 @@ uint16_t ZMachine::read_string(uint32_t addr, std::vector<char>& str, bool termi
                 uint8_t index = ((decoder_mode - 3) << 5) | c;
                 uint16_t paddr = read_tablew(_header.abbreviations_table, index);
                 uint32_t abbreviation = unpack_paddr(paddr, true);
-                read_string(abbreviation, str, false);
+                read_string(abbreviation, str);
                 decoder_mode = 0;
             }
             else if (decoder_mode == 6)
@@ -501,24 +1832,29 @@ uint16_t ZMachine::read_string(uint32_t addr, std::vector<char>& str, bool termi
             else if (decoder_mode == 7)
             {
                 zscii_code = zscii_code | (c & 0x1F);
-                decoder_mode = 0;
-
-                if (zscii_to_ascii(c, zscii_code, true))
-                {
-                    str.push_back(c);
-                }
-
+                const ZsciiCodec::Utf8& utf8 = _codec.to_utf8(zscii_code);
+                str.append(utf8.bytes, utf8.length);
                 decoder_mode = 0;
             }
         }
     }
 
-    if (terminate)
+    return len;
+}
+
+
+uint16_t ZMachine::string_length(uint32_t addr)
+{
+    // The last word of a string has its top bit set, nothing else needs decoding
+    uint32_t end = addr;
+
+    do
     {
-        str.push_back(0);
-    }
+        ZCHECK(end < _memory_size - 1);
+        end += 2;
+    } while ((_memory[end - 2] & 0x80) == 0);
 
-    return len;
+    return (uint16_t)(end - addr);
 }
 
 
@@ -594,25 +1930,69 @@ uint32_t ZMachine::popa()
 }
 
 
-void ZMachine::push_stack_frame()
+void ZMachine::push_stack_frame(uint8_t arg_count, bool store)
 {
     pusha(_pc);
     push(_locals_base);
+    push(arg_count | (store ? frame_stores_result : 0));
     _locals_base = _sp;
 }
 
 
-void ZMachine::pop_stack_frame()
+uint16_t ZMachine::pop_stack_frame()
 {
     _sp = _locals_base;
+    uint16_t frame = pop();
     _locals_base = pop();
     _pc = popa();
+    return frame;
+}
+
+
+void ZMachine::call_routine(const ZInstruction& instruction, bool store)
+{
+    uint32_t fnc = unpack_paddr(instruction.operands[0], false);
+
+    if (fnc == 0)
+    {
+        if (store)
+        {
+            store_result(0);
+        }
+
+        return;
+    }
+
+    uint8_t num_args = instruction.operand_count - 1;
+    push_stack_frame(num_args, store);
+    _pc = fnc;
+
+    uint8_t num_locals = read(_pc++);
+
+    for (uint8_t i = 0; i < num_locals; ++i)
+    {
+        uint16_t value = 0;
+
+        // Routines only hold initial values for their locals before version 5
+        if (_header.version < 5)
+        {
+            value = readw(_pc);
+            _pc += 2;
+        }
+
+        if (i < num_args)
+        {
+            value = instruction.operands[i + 1];
+        }
+
+        push(value);
+    }
 }
 
 
 uint16_t ZMachine::get_object_ptr(uint16_t object_index)
 {
-    ZCHECK(object_index > 0 && object_index < (_traits.object_traits.object_index_size_bytes << 8));
+    ZCHECK(object_index > 0 && object_index < (1u << (_traits.object_traits.object_index_size_bytes * 8)));
     uint16_t object_base = _header.object_table + (_traits.object_traits.max_properties << 1);
     uint16_t object_ptr = object_base + (object_index - 1) * _traits.object_traits.object_size_bytes;
     return object_ptr;
@@ -654,7 +2034,7 @@ void ZMachine::set_parent(uint16_t object_index, uint16_t parent_index)
 {
     uint16_t object_ptr = get_object_ptr(object_index);
     uint16_t parent_ptr = object_ptr + _traits.object_traits.attribute_flag_bytes;
-    (_traits.object_traits.object_index_size_bytes == 1) ? write(parent_ptr, (uint8_t)parent_index) : writew(parent_ptr, parent_index);
+    write_object_link(parent_ptr, parent_index);
 }
 
 
@@ -670,7 +2050,21 @@ void ZMachine::set_sibling(uint16_t object_index, uint16_t sibling_index)
 {
     uint16_t object_ptr = get_object_ptr(object_index);
     uint16_t sibling_ptr = object_ptr + _traits.object_traits.attribute_flag_bytes + _traits.object_traits.object_index_size_bytes;
-    (_traits.object_traits.object_index_size_bytes == 1) ? write(sibling_ptr, (uint8_t)sibling_index) : writew(sibling_ptr, sibling_index);
+    uint16_t old_sibling_index = get_sibling(object_index);
+    write_object_link(sibling_ptr, sibling_index);
+
+    if (!_prev_sibling_dirty)
+    {
+        if (old_sibling_index && old_sibling_index <= _object_count && _prev_sibling[old_sibling_index] == object_index)
+        {
+            _prev_sibling[old_sibling_index] = 0;
+        }
+
+        if (sibling_index && sibling_index <= _object_count)
+        {
+            _prev_sibling[sibling_index] = object_index;
+        }
+    }
 }
 
 
@@ -686,11 +2080,11 @@ void ZMachine::set_child(uint16_t object_index, uint16_t child_index)
 {
     uint16_t object_ptr = get_object_ptr(object_index);
     uint16_t child_ptr = object_ptr + _traits.object_traits.attribute_flag_bytes + _traits.object_traits.object_index_size_bytes * 2;
-    (_traits.object_traits.object_index_size_bytes == 1) ? write(child_ptr, (uint8_t)child_index) : writew(child_ptr, child_index);
+    write_object_link(child_ptr, child_index);
 }
 
 
-void ZMachine::get_object_short_name(uint16_t object_index, std::vector<char>& str)
+void ZMachine::get_object_short_name(uint16_t object_index, std::string& str)
 {
     uint16_t object_ptr = get_object_ptr(object_index);
     uint16_t property_ptr = readw(object_ptr + _traits.object_traits.attribute_flag_bytes + _traits.object_traits.object_index_size_bytes * 3);
@@ -698,16 +2092,19 @@ void ZMachine::get_object_short_name(uint16_t object_index, std::vector<char>& s
 
     if (short_name_len)
     {
-        read_string(property_ptr, str, true);
-    }
-    else
-    {
-        str.push_back(0);
+        read_string(property_ptr, str);
     }
 }
 
 uint16_t ZMachine::get_prop_addr(uint16_t object_index, uint8_t property_index)
 {
+    const PropertyIndexEntry* entry = find_property(object_index, property_index);
+
+    if (entry)
+    {
+        return entry->addr;
+    }
+
     uint16_t object_ptr = get_object_ptr(object_index);
     uint16_t property_table_addr = object_ptr + _traits.object_traits.attribute_flag_bytes + _traits.object_traits.object_index_size_bytes * 3;
     uint16_t property_ptr = readw(property_table_addr);
@@ -781,91 +2178,412 @@ uint8_t ZMachine::get_prop_index(uint16_t prop_addr)
 
 uint16_t ZMachine::get_prop(uint16_t object_index, uint8_t property_index)
 {
-    uint16_t prop_addr = get_prop_addr(object_index, property_index);
+    const PropertyIndexEntry* entry = find_property(object_index, property_index);
+    uint16_t prop_addr = entry ? entry->addr : get_prop_addr(object_index, property_index);
     uint16_t value;
 
     if (prop_addr)
     {
-        uint8_t prop_size = get_prop_len(prop_addr);
+        uint8_t prop_size = entry ? entry->length : get_prop_len(prop_addr);
+        ZCHECK(prop_size == 1 || prop_size == 2);
+
+        if (prop_size == 1)
+        {
+            value = read(prop_addr);
+        }
+        else
+        {
+            value = readw(prop_addr);
+        }
+    }
+    else
+    {
+        value = read_tablew(_header.object_table, property_index - 1);
+    }
+
+    return value;
+}
+
+
+void ZMachine::put_prop(uint16_t object_index, uint8_t property_index, uint16_t value)
+{
+    const PropertyIndexEntry* entry = find_property(object_index, property_index);
+    uint16_t prop_addr = entry ? entry->addr : get_prop_addr(object_index, property_index);
+
+    if (prop_addr)
+    {
+        uint8_t prop_size = entry ? entry->length : get_prop_len(prop_addr);
         ZCHECK(prop_size == 1 || prop_size == 2);
 
         if (prop_size == 1)
         {
-            value = read(prop_addr);
+            write(prop_addr, (uint8_t)value);
+        }
+        else
+        {
+            writew(prop_addr, value);
+        }
+    }
+    else
+    {
+        _print_buffer.clear();
+        get_object_short_name(object_index, _print_buffer);
+        crash("Illegal property access: obj %X [%s], prop %X\n", object_index, _print_buffer.c_str(), property_index);
+    }
+}
+
+
+uint8_t ZMachine::get_next_prop_index(uint16_t object_index, uint8_t property_index)
+{
+    const PropertyIndexEntry* entry = find_property(object_index, property_index);
+
+    if (entry)
+    {
+        return entry->next;
+    }
+
+    uint16_t prop_addr = 0;
+
+    if (property_index == 0)
+    {
+        uint16_t object_ptr = get_object_ptr(object_index);
+        uint16_t property_table_addr = object_ptr + _traits.object_traits.attribute_flag_bytes + _traits.object_traits.object_index_size_bytes * 3;
+        prop_addr = readw(property_table_addr);
+        uint8_t header_size = read(prop_addr++);
+        prop_addr += header_size << 1;
+    }
+    else
+    {
+        prop_addr = get_prop_addr(object_index, property_index);
+        prop_addr += get_prop_len(prop_addr);
+    }
+
+    uint8_t size_byte = read(prop_addr);
+    uint8_t next_index = 0;
+
+    if (_header.version < 4)
+    {
+        next_index = size_byte & 0x1F;
+    }
+    else
+    {
+        next_index = size_byte & 0x3F;
+    }
+
+    return next_index;
+}
+
+
+void ZMachine::build_property_index()
+{
+    /*
+        For each object a dense table of (max_properties + 1) entries, indexed by property number. Entry 0 holds the
+        first property in the object's list in 'next'. The bytes that define the layout (the object's property table
+        pointer, the short name length and each property's size byte(s)) are flagged in _property_headers so write()
+        can tell when the story rewrites them and the index has to be rebuilt.
+    */
+    const ObjectTraits& traits = _traits.object_traits;
+    uint16_t stride = traits.max_properties + 1;
+    uint32_t object_base = _header.object_table + (traits.max_properties << 1);
+    uint8_t property_ptr_offset = traits.attribute_flag_bytes + traits.object_index_size_bytes * 3;
+    uint16_t object_count = count_objects();
+
+    _property_index.assign((object_count + 1) * stride, PropertyIndexEntry{});
+    _indexed_objects = object_count;
+
+    uint32_t headers_lo = object_base;
+    uint32_t headers_hi = object_base + object_count * traits.object_size_bytes;
+    std::vector<uint32_t>& header_addrs = _property_header_addrs;
+    header_addrs.clear();
+
+    for (uint16_t object_index = 1; object_index <= object_count; ++object_index)
+    {
+        uint32_t object_ptr = object_base + (object_index - 1) * traits.object_size_bytes;
+        uint32_t property_ptr = make_word(_memory[object_ptr + property_ptr_offset], _memory[object_ptr + property_ptr_offset + 1]);
+        PropertyIndexEntry* entries = &_property_index[object_index * stride];
+        PropertyIndexEntry* prev = &entries[0];
+
+        header_addrs.push_back(object_ptr + property_ptr_offset);
+        header_addrs.push_back(object_ptr + property_ptr_offset + 1);
+
+        if (property_ptr >= _memory_size)
+        {
+            continue;
+        }
+
+        header_addrs.push_back(property_ptr);
+        property_ptr += 1 + (_memory[property_ptr] << 1);
+
+        while (property_ptr < _memory_size)
+        {
+            uint8_t size_byte = _memory[property_ptr];
+            uint8_t property_number = 0;
+            uint8_t property_size = 0;
+            header_addrs.push_back(property_ptr++);
+
+            if (size_byte == 0)
+            {
+                break;
+            }
+
+            if (_header.version < 4)
+            {
+                property_number = size_byte & 0x1F;
+                property_size = (size_byte >> 5) + 1;
+            }
+            else if ((size_byte & 0x80) == 0)
+            {
+                property_number = size_byte & 0x3F;
+                property_size = (size_byte & 0x40) ? 2 : 1;
+            }
+            else if (property_ptr < _memory_size)
+            {
+                property_number = size_byte & 0x3F;
+                property_size = _memory[property_ptr] & 0x3F;
+                property_size = property_size ? property_size : 64;
+                header_addrs.push_back(property_ptr++);
+            }
+
+            if (property_number == 0 || property_number > traits.max_properties || property_ptr + property_size > _memory_size)
+            {
+                break;
+            }
+
+            entries[property_number].addr = (uint16_t)property_ptr;
+            entries[property_number].length = property_size;
+            prev->next = property_number;
+            prev = &entries[property_number];
+            property_ptr += property_size;
+        }
+    }
+
+    for (uint32_t addr : header_addrs)
+    {
+        headers_lo = std::min(headers_lo, addr);
+        headers_hi = std::max(headers_hi, addr + 1);
+    }
+
+    _property_headers_base = headers_lo;
+    _property_headers_size = headers_hi - headers_lo;
+    _property_headers.assign((_property_headers_size + 7) >> 3, 0);
+
+    for (uint32_t addr : header_addrs)
+    {
+        _property_headers[(addr - headers_lo) >> 3] |= 1 << ((addr - headers_lo) & 7);
+    }
+
+    _property_entries = _property_index.data();
+    _property_header_bits = _property_headers.data();
+
+    _property_index_dirty = false;
+}
+
+
+uint16_t ZMachine::count_objects()
+{
+    // The object count isn't stored anywhere; property tables follow the object entries so the lowest property table
+    // address bounds the table.
+    const ObjectTraits& traits = _traits.object_traits;
+    uint32_t object_base = _header.object_table + (traits.max_properties << 1);
+    uint8_t property_ptr_offset = traits.attribute_flag_bytes + traits.object_index_size_bytes * 3;
+    uint32_t max_objects = (1u << (traits.object_index_size_bytes * 8)) - 1;
+    uint32_t objects_end = _memory_size;
+    uint16_t object_count = 0;
+
+    for (uint32_t object_ptr = object_base; object_ptr + traits.object_size_bytes <= objects_end && object_count < max_objects;
+         object_ptr += traits.object_size_bytes)
+    {
+        uint16_t property_table = make_word(_memory[object_ptr + property_ptr_offset], _memory[object_ptr + property_ptr_offset + 1]);
+
+        if (property_table > object_ptr && property_table < objects_end)
+        {
+            objects_end = property_table;
+        }
+
+        ++object_count;
+    }
+
+    return object_count;
+}
+
+
+void ZMachine::build_prev_siblings()
+{
+    // _prev_sibling[x] is the object whose sibling link is x, so only set_sibling (or a story poking a sibling link
+    // directly) can change it.
+    const ObjectTraits& traits = _traits.object_traits;
+    _object_count = count_objects();
+    _object_entries_base = _header.object_table + (traits.max_properties << 1);
+    _object_entries_size = _object_count * traits.object_size_bytes;
+    _prev_sibling.assign(_object_count + 1, 0);
+
+    for (uint16_t object_index = 1; object_index <= _object_count; ++object_index)
+    {
+        uint32_t sibling_ptr = _object_entries_base + (object_index - 1) * traits.object_size_bytes + traits.attribute_flag_bytes +
+                               traits.object_index_size_bytes;
+        uint16_t sibling_index = (traits.object_index_size_bytes == 1) ? _memory[sibling_ptr] : make_word(_memory[sibling_ptr], _memory[sibling_ptr + 1]);
+
+        if (sibling_index && sibling_index <= _object_count)
+        {
+            _prev_sibling[sibling_index] = object_index;
+        }
+    }
+
+    _prev_sibling_dirty = false;
+}
+
+
+uint16_t ZMachine::get_prev_sibling(uint16_t object_index)
+{
+    if (_prev_sibling_dirty)
+    {
+        build_prev_siblings();
+    }
+
+    if (object_index <= _object_count)
+    {
+        return _prev_sibling[object_index];
+    }
+
+    // Object outside the table bounds found at load, walk the parent's children
+    uint16_t prev_index = 0;
+    uint16_t parent_index = get_parent(object_index);
+
+    if (parent_index)
+    {
+        for (uint16_t child_index = get_child(parent_index); child_index && child_index != object_index; child_index = get_sibling(child_index))
+        {
+            prev_index = child_index;
+        }
+    }
+
+    return prev_index;
+}
+
+
+void ZMachine::unlink_object(uint16_t object_index)
+{
+    uint16_t parent_index = get_parent(object_index);
+
+    if (parent_index)
+    {
+        uint16_t sibling_index = get_sibling(object_index);
+        uint16_t prev_index = get_prev_sibling(object_index);
+
+        if (prev_index)
+        {
+            ZCHECK(get_sibling(prev_index) == object_index);
+            set_sibling(prev_index, sibling_index);
         }
         else
         {
-            value = readw(prop_addr);
+            ZCHECK(get_child(parent_index) == object_index);
+            set_child(parent_index, sibling_index);
         }
+
+        set_sibling(object_index, 0);
+    }
+}
+
+
+void ZMachine::write_object_link(uint32_t addr, uint16_t object_index)
+{
+    // Object tree setters keep the shadow links up to date themselves so bypass the checks in write()
+    if (_traits.object_traits.object_index_size_bytes == 1)
+    {
+        ZCHECK(addr < _memory_size);
+        _memory[addr] = (uint8_t)object_index;
+        mark_written(addr, 1);
     }
     else
     {
-        value = read_tablew(_header.object_table, property_index - 1);
+        ZCHECK(addr < _memory_size - 1);
+        _memory[addr] = hi(object_index);
+        _memory[addr + 1] = lo(object_index);
+        mark_written(addr, 2);
     }
+}
 
-    return value;
+
+void ZMachine::mark_written(uint32_t addr, uint32_t size)
+{
+    // For writes that bypass write()
+    for (uint32_t page = addr / snapshot_page_size; page <= (addr + size - 1) / snapshot_page_size; ++page)
+    {
+        _dirty_pages[page] = 1;
+    }
 }
 
 
-void ZMachine::put_prop(uint16_t object_index, uint8_t property_index, uint16_t value)
+const Dictionary& ZMachine::dictionary(uint16_t addr)
 {
-    uint16_t prop_addr = get_prop_addr(object_index, property_index);
+    finish_tables();
 
-    if (get_prop_addr(object_index, property_index))
+    if (_dictionaries_dirty)
     {
-        uint8_t prop_size = get_prop_len(prop_addr);
-        ZCHECK(prop_size == 1 || prop_size == 2);
+        // Rare: rebuild the main dictionary and let user dictionaries rebuild on demand
+        _user_dictionaries.clear();
+        _dictionary_writes_base = 0;
+        _dictionary_writes_size = 0;
+        _dictionary.build(_memory, _memory_size, _header.dictionary_table, _traits.dictionary_word_length);
+        watch_dictionary(_dictionary);
+        _dictionaries_dirty = false;
+    }
 
-        if (prop_size == 1)
-        {
-            write(prop_addr, (uint8_t)value);
-        }
-        else
-        {
-            writew(prop_addr, value);
-        }
+    if (addr == 0 || addr == _header.dictionary_table)
+    {
+        return _dictionary;
     }
-    else
+
+    auto it = _user_dictionaries.find(addr);
+
+    if (it == _user_dictionaries.end())
     {
-        std::vector<char> short_name;
-        short_name.reserve(766);
-        get_object_short_name(object_index, short_name);
-        crash("Illegal property access: obj %X [%s], prop %X\n", object_index, short_name, property_index);
+        it = _user_dictionaries.emplace(addr, Dictionary{}).first;
+        ZCHECK(it->second.build(_memory, _memory_size, addr, _traits.dictionary_word_length));
+        watch_dictionary(it->second);
     }
+
+    return it->second;
 }
 
 
-uint8_t ZMachine::get_next_prop_index(uint16_t object_index, uint8_t property_index)
+void ZMachine::watch_dictionary(const Dictionary& dictionary)
 {
-    uint16_t prop_addr = 0;
+    // Only dictionaries in dynamic memory can change under us
+    uint32_t lo = dictionary.addr();
+    uint32_t hi = std::min(dictionary.end(), (uint32_t)_header.static_mem_base);
 
-    if (property_index == 0)
+    if (lo >= hi)
     {
-        uint16_t object_ptr = get_object_ptr(object_index);
-        uint16_t property_table_addr = object_ptr + _traits.object_traits.attribute_flag_bytes + _traits.object_traits.object_index_size_bytes * 3;
-        prop_addr = readw(property_table_addr);
-        uint8_t header_size = read(prop_addr++);
-        prop_addr += header_size << 1;
+        return;
     }
-    else
+
+    if (_dictionary_writes_size)
     {
-        prop_addr = get_prop_addr(object_index, property_index);
-        prop_addr += get_prop_len(prop_addr);
+        hi = std::max(hi, _dictionary_writes_base + _dictionary_writes_size);
+        lo = std::min(lo, _dictionary_writes_base);
     }
 
-    uint8_t size_byte = read(prop_addr);
-    uint8_t next_index = 0;
+    _dictionary_writes_base = lo;
+    _dictionary_writes_size = hi - lo;
+}
 
-    if (_header.version < 4)
+
+const ZMachine::PropertyIndexEntry* ZMachine::find_property(uint16_t object_index, uint8_t property_index)
+{
+    if (_property_index_dirty)
     {
-        next_index = size_byte & 0x1F;
+        build_property_index();
     }
-    else
+
+    if (object_index == 0 || object_index > _indexed_objects || property_index > _traits.object_traits.max_properties)
     {
-        next_index = size_byte & 0x3F;
+        // Not covered by the index, caller falls back to walking the property list
+        return nullptr;
     }
 
-    return next_index;
+    return &_property_entries[object_index * (_traits.object_traits.max_properties + 1) + property_index];
 }
 
 
@@ -912,30 +2630,21 @@ void ZMachine::apply_predicate(bool test)
 
 void ZMachine::ret(uint16_t result)
 {
-    pop_stack_frame();
-    store_result(result);
-}
-
-
-bool ZMachine::zscii_to_ascii(char& ascii_code, uint16_t zscii_code, bool for_output)
-{
-    bool skip = true;
-
-    if (for_output)
+    if (_locals_base == _interrupt_frame)
     {
-        if (zscii_code == 13)
-        {
-            ascii_code = '\n';
-            skip = false;
-        }
-        else if (zscii_code >= 32 && zscii_code < 127)
-        {
-            ascii_code = (char)zscii_code;
-            skip = false;
-        }
+        // An interrupt routine has no store byte, its result goes back to the input instruction it interrupted
+        pop_stack_frame();
+        _interrupt_frame = 0;
+        _interrupt_result = result;
+        _interrupt_returned = true;
+        (this->*_suspended_handler)(_suspended_instruction);
+        return;
     }
 
-    return !skip;
+    if (pop_stack_frame() & frame_stores_result)
+    {
+        store_result(result);
+    }
 }
 
 
@@ -960,171 +2669,353 @@ uint32_t ZMachine::unpack_paddr(uint16_t paddr, bool string)
 }
 
 
-void ZMachine::parse(uint16_t text_buffer, uint16_t parse_buffer)
+uint8_t ZMachine::encode_zchars(const uint8_t* text, size_t length, uint8_t* zchars)
 {
-    // FIXME: do this in reset
-    uint8_t num_word_separators = read_table(_header.dictionary_table, 0);
+    finish_tables();
 
-    std::string word_separators;
-    word_separators.reserve(num_word_separators);
+    // zchars must have room for (dictionary_word_length * 3) + 3 Z-characters
+    size_t limit = _traits.dictionary_word_length * 3;
+    size_t count = 0;
 
-    for (uint8_t i = 0; i < num_word_separators; ++i)
+    for (size_t i = 0; i < length && count < limit; ++i)
     {
-        word_separators.push_back(read_table(_header.dictionary_table, i + 1));
+        const ZsciiCodec::ZChars& encoded = _codec.encode(text[i]);
+
+        for (uint8_t z = 0; z < encoded.length; ++z)
+        {
+            zchars[count++] = encoded.zchars[z];
+        }
     }
 
-    uint8_t num_words = 0;
-    uint8_t max_words = read(parse_buffer);
-    uint8_t text_len = read(text_buffer);
-    uint8_t end_pos = 1;
+    return (uint8_t)std::min(count, limit);
+}
+
+
+void ZMachine::tokenise(uint16_t text_buffer, uint16_t parse_buffer, const Dictionary& dict, bool skip_unknown)
+{
+    /*
+        Text is copied into a zero padded stack buffer and scanned 16 bytes at a time for spaces and word separators,
+        giving a bitmask of word boundaries. Words are then found by bit scanning the mask and only the boundary
+        characters are looked up in the dictionary's character class table.
+    */
+    static constexpr size_t max_text = 256;
+    alignas(16) uint8_t text[max_text + 16];
+    uint16_t boundaries[(max_text / 16) + 1];
+    uint8_t text_start = (_header.version < 5) ? 1 : 2;
+    size_t text_len = 0;
+
+    ZCHECK((uint32_t)text_buffer + text_start <= _memory_size);
+    const uint8_t* text_ptr = _memory + text_buffer + text_start;
 
-    for ( ; end_pos < text_len; end_pos++)
+    if (_header.version < 5)
     {
-        if (read_table(text_buffer, end_pos) == 0)
-            break;
+        // Zero terminated
+        size_t max_len = std::min((size_t)read(text_buffer), (size_t)(_memory_size - text_buffer - text_start));
+        const void* terminator = std::memchr(text_ptr, 0, max_len);
+        text_len = terminator ? (const uint8_t*)terminator - text_ptr : max_len;
+    }
+    else
+    {
+        text_len = std::min((size_t)read(text_buffer + 1), (size_t)(_memory_size - text_buffer - text_start));
+    }
+
+    text_len = std::min(text_len, max_text - 1);
+    std::memcpy(text, text_ptr, text_len);
+    std::memset(text + text_len, 0, sizeof(text) - text_len);
+
+    // Sentinel so every word ends on a boundary
+    text[text_len] = ' ';
+
+    const std::vector<uint8_t>& separators = dict.separators();
+    const __m128i spaces = _mm_set1_epi8(' ');
+    size_t num_chunks = (text_len >> 4) + 1;
+
+    for (size_t chunk = 0; chunk < num_chunks; ++chunk)
+    {
+        __m128i chars = _mm_load_si128((const __m128i*)(text + (chunk << 4)));
+        __m128i matches = _mm_cmpeq_epi8(chars, spaces);
+
+        for (uint8_t separator : separators)
+        {
+            matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chars, _mm_set1_epi8((char)separator)));
+        }
+
+        boundaries[chunk] = (uint16_t)_mm_movemask_epi8(matches);
     }
 
-    for (uint8_t char_pos = 1; char_pos < end_pos && num_words < max_words;)
+    uint8_t num_words = 0;
+    uint8_t max_words = read(parse_buffer);
+    size_t pos = 0;
+
+    while (pos < text_len && num_words < max_words)
     {
-        std::vector<uint8_t> encode_buffer;
-        uint8_t word_start = char_pos;
-        uint8_t word_length = 0;
+        // Next boundary at or after pos
+        size_t chunk = pos >> 4;
+        unsigned long bits = boundaries[chunk] & (0xFFFF << (pos & 0xF));
 
-        for (; char_pos < text_len;)
+        while (!bits)
         {
-            uint8_t c = read_table(text_buffer, char_pos++);
-            const char* pos;
+            bits = boundaries[++chunk];
+        }
 
-            if (c == ' ')
+        unsigned long bit;
+        _BitScanForward(&bit, bits);
+        size_t end = (chunk << 4) + bit;
+
+        if (end == pos)
+        {
+            if (dict.char_class(text[pos]) == Dictionary::Space)
             {
                 // Spaces separate words and are otherwise ignored
-                break;
-            }
-            else if (pos = std::strchr(word_separators.c_str(), c))
-            {
-                // Other word separators are considered words in their own right
-                if (encode_buffer.empty())
-                {
-                    encode_buffer.push_back(*pos);
-                    ++word_length;
-                }
-                else
-                {
-                    --char_pos;
-                }
-                break;
-            }
-            else if (pos = std::strchr(default_alphabet[0], c))
-            {
-                uint8_t c = (uint8_t)(pos - default_alphabet[0]);
-                encode_buffer.push_back(c);
-                ++word_length;
-            }
-            else if (pos = std::strchr(default_alphabet[2], c))
-            {
-                uint8_t c = (uint8_t)(pos - default_alphabet[2]);
-                // c ought to be > 7
-                ZCHECK(c > 7);
-                encode_buffer.push_back(5);
-                encode_buffer.push_back(c);
-                ++word_length;
-            }
-            else
-            {
-                encode_buffer.push_back(5);
-                encode_buffer.push_back(6);
-                encode_buffer.push_back(c >> 5);
-                encode_buffer.push_back(c & 0x1f);
-                ++word_length;
+                ++pos;
+                continue;
             }
+
+            // Other word separators are considered words in their own right
+            end = pos + 1;
         }
 
-        size_t encode_buffer_size = encode_buffer.size();
+        uint8_t zchars[12];
+        uint8_t num_zchars = encode_zchars(text + pos, end - pos, zchars);
+        uint16_t matched_entry_addr = dict.find(dict.make_key(zchars, num_zchars));
+        uint16_t entry = parse_buffer + 2 + (num_words << 2);
 
-        if (encode_buffer_size)
+        if (matched_entry_addr || !skip_unknown)
         {
-            while (encode_buffer_size % 6)
-            {
-                encode_buffer.push_back(5);
-                encode_buffer_size++;
-            }
+            writew(entry, matched_entry_addr);
+            write(entry + 2, (uint8_t)(end - pos));
+            write(entry + 3, (uint8_t)(pos + text_start));
+        }
 
-            std::vector<uint16_t> encoded_word;
-            encoded_word.reserve(_traits.dictionary_word_length);
+        ++num_words;
+        pos = end;
+    }
 
-            for (uint8_t j = 0; j < _traits.dictionary_word_length; j++)
-            {
-                uint16_t triplet = (encode_buffer[(j * 3) + 0] & 0x1F) << 10 |
-                                   (encode_buffer[(j * 3) + 1] & 0x1F) << 5 |
-                                   (encode_buffer[(j * 3) + 2] & 0x1F);
-                encoded_word.push_back(triplet);
-            }
+    write_table(parse_buffer, 1, num_words);
+}
 
-            encoded_word.back() |= 0x8000;
 
-            // Endian swap encoded word so it can be compared with dictionary word in memory
-            // TODO: extract and unpack the dictionary...
-            for (uint16_t& w : encoded_word)
-            {
-                w = swap_endian(w);
-            }
+void ZMachine::write_sink(OutputStream::Type stream, std::string_view text)
+{
+    OutputSink* sink = _output_sinks[stream];
 
-            // TODO: cache in reset
-            uint16_t dictionary_length = readw(_header.dictionary_table + num_word_separators + 2);
-            uint16_t entry_size = read(_header.dictionary_table + num_word_separators + 1);
-            uint16_t dictionary_entries = _header.dictionary_table + num_word_separators + 4;
-	        uint16_t first_entry = 0;
-            uint16_t last_entry = dictionary_length - 1;
-            uint16_t matched_entry_addr = 0;
+    if (!sink)
+    {
+        return;
+    }
 
-            while (last_entry >= first_entry)
-            {
-                uint16_t entry = (first_entry + last_entry) >> 1;
-                uint16_t address = dictionary_entries + entry * entry_size;
-                int diff = memcmp(encoded_word.data(), _memory + address, _traits.dictionary_word_length << 1);
+#if defined(ZILG_COUNT_ALLOCATIONS)
+    // Sinks belong to the host, so their allocations aren't charged to the machine
+    uint64_t allocations = allocation_count();
+    sink->write(text, _text_style, _window);
+    _sink_allocations += allocation_count() - allocations;
+#else
+    sink->write(text, _text_style, _window);
+#endif
+}
 
-                if (diff > 0)
-                {
-                    first_entry = entry + 1;
-                }
-                else if (diff < 0)
-                {
-                    last_entry = entry - 1;
-                }
-                else
-                {
-                    matched_entry_addr = address;
-                    break;
-                }
-            }
 
-            write_table(parse_buffer + 2, (num_words * 4) + 0, hi(matched_entry_addr));
-            write_table(parse_buffer + 2, (num_words * 4) + 1, lo(matched_entry_addr));
-            write_table(parse_buffer + 2, (num_words * 4) + 2, word_length);
-            write_table(parse_buffer + 2, (num_words * 4) + 3, word_start);
-            ++num_words;
+void ZMachine::write_memory_stream(std::string_view text)
+{
+    finish_tables();
+
+    // Stream 3 holds ZSCII, so map the UTF-8 output back
+    MemoryStream& stream = _memory_streams[_memory_stream_depth - 1];
+
+    for (size_t i = 0; i < text.size();)
+    {
+        uint8_t lead = (uint8_t)text[i];
+        uint16_t codepoint = lead;
+        size_t length = 1;
+
+        if (lead >= 0xE0 && i + 2 < text.size())
+        {
+            codepoint = ((lead & 0x0F) << 12) | ((text[i + 1] & 0x3F) << 6) | (text[i + 2] & 0x3F);
+            length = 3;
+        }
+        else if (lead >= 0xC0 && i + 1 < text.size())
+        {
+            codepoint = ((lead & 0x1F) << 6) | (text[i + 1] & 0x3F);
+            length = 2;
+        }
+
+        uint32_t addr = (uint32_t)stream.table + 2 + stream.length;
+
+        if (addr >= _memory_size)
+        {
+            crash("Memory stream table %04X runs past the end of memory\n", stream.table);
         }
+
+        uint8_t zscii = _codec.from_unicode(codepoint);
+        write(addr, zscii ? zscii : '?');
+        stream.length++;
+        i += length;
     }
+}
 
-    write_table(parse_buffer, 1, num_words);
+
+void ZMachine::echo_input(std::string_view text)
+{
+    // Input goes to the screen and transcript like any other text, and on its own to the command script
+    print(text);
+    print("\n");
+
+    if (_command_script_selected)
+    {
+        write_sink(OutputStream::CommandScript, text);
+        write_sink(OutputStream::CommandScript, "\n");
+    }
+}
+
+
+void ZMachine::suspend(const ZInstruction& instruction, InstructionHandler handler, uint16_t timeout, uint16_t routine)
+{
+    // Input instructions call this when they have nothing to read, update() calls the handler again with the same
+    // operands once the host has had a chance to provide input
+    _suspended_instruction = instruction;
+    _suspended_handler = handler;
+    _input_timeout = timeout;
+    _input_routine = timeout ? routine : 0;
+    set_state(State::InputRequested);
+}
+
+
+void ZMachine::call_interrupt(uint16_t routine)
+{
+    uint32_t fnc = unpack_paddr(routine, false);
+
+    if (fnc == 0)
+    {
+        _interrupt_result = 0;
+        _interrupt_returned = true;
+        (this->*_suspended_handler)(_suspended_instruction);
+        return;
+    }
+
+    push_stack_frame(0, false);
+    _interrupt_frame = _locals_base;
+    _pc = fnc;
+
+    uint8_t num_locals = read(_pc++);
+
+    for (uint8_t i = 0; i < num_locals; ++i)
+    {
+        uint16_t value = 0;
+
+        if (_header.version < 5)
+        {
+            value = readw(_pc);
+            _pc += 2;
+        }
+
+        push(value);
+    }
+}
+
+
+bool ZMachine::input_interrupted()
+{
+    // True when an interrupt routine has just returned true, which ends the input without a terminating key
+    bool interrupted = _interrupt_returned && _interrupt_result;
+    _interrupt_returned = false;
+    return interrupted;
+}
+
+
+bool ZMachine::read_line(ZInstruction& instruction, InstructionHandler handler, uint8_t& terminator)
+{
+    // Leaves the line in _input_line and returns true, or suspends the instruction until there is one
+    if (input_interrupted())
+    {
+        terminator = 0;
+        return true;
+    }
+
+    size_t line_end = _input_queue.find('\n');
+
+    if (line_end != std::string::npos)
+    {
+        _input_line.assign(_input_queue, 0, line_end);
+        _input_queue.erase(0, line_end + 1);
+        terminator = 13;
+        echo_input(_input_line);
+        return true;
+    }
+
+    for (size_t i = 0; i < _key_queue.size(); ++i)
+    {
+        uint8_t key = (uint8_t)_key_queue[i];
+
+        if (key == 13)
+        {
+            _key_queue.erase(0, i + 1);
+            terminator = 13;
+            echo_input(_input_line);
+            return true;
+        }
+        else if (key == 8)
+        {
+            if (!_input_line.empty())
+            {
+                _input_line.pop_back();
+            }
+        }
+        else if ((key >= 32 && key < 127) || (key >= 155 && key < 252))
+        {
+            _input_line.push_back((char)key);
+        }
+    }
+
+    _key_queue.clear();
+
+    bool timed = _header.version >= 4 && instruction.operand_count >= 4;
+    suspend(instruction, handler, timed ? instruction.operands[2] : 0, timed ? instruction.operands[3] : 0);
+    return false;
 }
 
 
-void ZMachine::flush_line()
+void ZMachine::store_line(uint16_t text_buffer, uint16_t parse_buffer)
 {
-    std::string line;
-    while (std::getline(_linebuffer, line))
+    // Before v5 byte 0 holds the maximum number of characters plus one and the text is zero terminated. From v5 byte
+    // 0 is the maximum number of characters and byte 1 the number stored.
+    uint8_t buffer_len = read(text_buffer);
+    uint8_t text_offset = _header.version < 5 ? 1 : 2;
+    size_t max_len = _header.version < 5 ? (buffer_len ? buffer_len - 1 : 0) : buffer_len;
+    size_t input_len = std::min(_input_line.size(), max_len);
+    ZCHECK((uint32_t)text_buffer + text_offset + input_len < _memory_size);
+    uint8_t* text = _memory + text_buffer + text_offset;
+    mark_written(text_buffer, text_offset + (uint32_t)input_len + 1);
+
+    for (size_t i = 0; i < input_len; ++i)
+    {
+        uint8_t c = (uint8_t)_input_line[i];
+        text[i] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    }
+
+    if (_header.version < 5)
+    {
+        text[input_len] = 0;
+    }
+    else
+    {
+        _memory[text_buffer + 1] = (uint8_t)input_len;
+    }
+
+    _input_line.clear();
+
+    if (parse_buffer)
     {
-        _transcript.push_back(line);
+        tokenise(text_buffer, parse_buffer, dictionary(0), false);
     }
-    _linebuffer.str(std::string());
-    _linebuffer.clear();
 }
 
 
 void ZMachine::crash(const char* format, ...)
 {
-    _linebuffer << "\n\n***** CRASH *****\n";
+    // The banner goes to the screen and transcript even if stream 3 is selected, the stream's table may be what
+    // crashed the machine
+    _memory_stream_depth = 0;
+    print("\n\n***** CRASH *****\n");
     std::va_list args;
     va_start(args, format);
     logv(format, args);
@@ -1271,32 +3162,10 @@ void ZMachine::_insert_obj(ZInstruction& instruction)
     uint16_t object_index = instruction.operands[0];
 
     // Unlink object from current parent and siblings
-    uint16_t parent_index = get_parent(object_index);
-
-    if (parent_index)
-    {
-        uint16_t sibling_index = get_sibling(object_index);
-        uint16_t prev_index = 0;
-
-        for (uint16_t child_index = get_child(parent_index); child_index != object_index; child_index = get_sibling(child_index))
-        {
-            prev_index = child_index;
-        }
-
-        if (prev_index)
-        {
-            set_sibling(prev_index, sibling_index);
-        }
-        else
-        {
-            set_child(parent_index, sibling_index);
-        }
-
-        set_sibling(object_index, 0);
-    }
+    unlink_object(object_index);
 
     // Add as first child of new parent
-    parent_index = instruction.operands[1];
+    uint16_t parent_index = instruction.operands[1];
     set_parent(object_index, parent_index);
 
     if (parent_index)
@@ -1398,11 +3267,33 @@ void ZMachine::_mod(ZInstruction& instruction)
 }
 
 
-void ZMachine::_call_2s_4(ZInstruction& instruction) {}
-void ZMachine::_call_2n_5(ZInstruction& instruction) {}
+void ZMachine::_call_2s_4(ZInstruction& instruction)
+{
+    call_routine(instruction, true);
+}
+
+
+void ZMachine::_call_2n_5(ZInstruction& instruction)
+{
+    call_routine(instruction, false);
+}
+
+
 void ZMachine::_set_colour_5(ZInstruction& instruction) {}
 void ZMachine::_set_colour_6(ZInstruction& instruction) {}
-void ZMachine::_throw_5(ZInstruction& instruction) {}
+
+
+void ZMachine::_throw_5(ZInstruction& instruction)
+{
+    // Returns from the routine that caught the frame, dropping the frames called since. An input interrupt can't be
+    // unwound, its routine has to return to the input instruction.
+    uint16_t value = instruction.operands[0];
+    uint16_t frame = instruction.operands[1];
+    ZCHECK(frame >= _locals_base && frame < 0xFFFF);
+    ZCHECK(_interrupt_frame == 0 || frame <= _interrupt_frame);
+    _locals_base = frame;
+    ret(value);
+}
 
 
 void ZMachine::_jz(ZInstruction& instruction)
@@ -1472,15 +3363,22 @@ void ZMachine::_dec(ZInstruction& instruction)
 
 void ZMachine::_print_addr(ZInstruction& instruction)
 {
+    if (output_discarded())
+    {
+        return;
+    }
+
     uint16_t addr = instruction.operands[0];
-    std::vector<char> str;
-    str.reserve(128);
-    read_string(addr, str, true);
-    _linebuffer << str.data();
+    _print_buffer.clear();
+    read_string(addr, _print_buffer);
+    print(_print_buffer);
 }
 
 
-void ZMachine::_call_1s_4(ZInstruction& instruction) {}
+void ZMachine::_call_1s_4(ZInstruction& instruction)
+{
+    call_routine(instruction, true);
+}
 
 
 void ZMachine::_remove_obj(ZInstruction& instruction)
@@ -1493,11 +3391,15 @@ void ZMachine::_remove_obj(ZInstruction& instruction)
 
 void ZMachine::_print_obj(ZInstruction& instruction)
 {
+    if (output_discarded())
+    {
+        return;
+    }
+
     uint16_t object_index = instruction.operands[0];
-    std::vector<char> short_name;
-    short_name.reserve(756);
-    get_object_short_name(object_index, short_name);
-    _linebuffer << short_name.data();
+    _print_buffer.clear();
+    get_object_short_name(object_index, _print_buffer);
+    print(_print_buffer);
 }
 
 
@@ -1516,11 +3418,15 @@ void ZMachine::_jump(ZInstruction& instruction)
 
 void ZMachine::_print_paddr(ZInstruction& instruction)
 {
+    if (output_discarded())
+    {
+        return;
+    }
+
     uint32_t paddr = unpack_paddr(instruction.operands[0], true);
-    std::vector<char> str;
-    str.reserve(128);
-    read_string(paddr, str, true);
-    _linebuffer << str.data();
+    _print_buffer.clear();
+    read_string(paddr, _print_buffer);
+    print(_print_buffer);
 }
 
 
@@ -1537,7 +3443,13 @@ void ZMachine::_not(ZInstruction& instruction)
     uint16_t value = ~a; 
     store_result(value);
 }
-void ZMachine::_call_1n_5(ZInstruction& instruction) {}
+
+
+void ZMachine::_call_1n_5(ZInstruction& instruction)
+{
+    call_routine(instruction, false);
+}
+
 
 void ZMachine::_rtrue(ZInstruction& instruction)
 {
@@ -1553,21 +3465,33 @@ void ZMachine::_rfalse(ZInstruction& instruction)
 
 void ZMachine::_print(ZInstruction& instruction)
 {
-    std::vector<char> str;
-    str.reserve(128);
-    uint16_t literal_length = read_string(_pc, str, true);
+    if (output_discarded())
+    {
+        _pc += string_length(_pc);
+        return;
+    }
+
+    _print_buffer.clear();
+    uint16_t literal_length = read_string(_pc, _print_buffer);
     _pc += literal_length;
-    _linebuffer << str.data();
+    print(_print_buffer);
 }
 
 
 void ZMachine::_print_ret(ZInstruction& instruction)
 {
-    std::vector<char> str;
-    str.reserve(128);
-    uint16_t literal_length = read_string(_pc, str, true);
+    if (output_discarded())
+    {
+        _pc += string_length(_pc);
+        ret(1);
+        return;
+    }
+
+    _print_buffer.clear();
+    uint16_t literal_length = read_string(_pc, _print_buffer);
     _pc += literal_length;
-    _linebuffer << str.data() << "\n";
+    _print_buffer.push_back('\n');
+    print(_print_buffer);
     ret(1);
 }
 
@@ -1595,54 +3519,42 @@ void ZMachine::_pop(ZInstruction& instruction)
 }
 
 
-void ZMachine::_catch_5(ZInstruction& instruction) {}
+void ZMachine::_catch_5(ZInstruction& instruction)
+{
+    store_result(_locals_base);
+}
+
+
 void ZMachine::_quit(ZInstruction& instruction) {}
 
 
 void ZMachine::_new_line(ZInstruction& instruction)
 {
-    _linebuffer << "\n";
+    print("\n");
 }
 
 
 void ZMachine::_show_status(ZInstruction& instruction) {}
 void ZMachine::_verify(ZInstruction& instruction) {}
 void ZMachine::_extended_5(ZInstruction& instruction) {}
-void ZMachine::_piracy_5(ZInstruction& instruction) {}
 
 
-void ZMachine::_call(ZInstruction& instruction)
+void ZMachine::_piracy_5(ZInstruction& instruction)
 {
-    uint32_t fnc = unpack_paddr(instruction.operands[0], false);
-
-    if (fnc == 0)
-    {
-        store_result(0);
-        return;
-    }
-
-    push_stack_frame();
-    _pc = fnc;
-
-    uint8_t num_locals = read(_pc++);
-    uint8_t num_args = instruction.operand_count - 1;
-
-    for (uint8_t i = 0; i < num_locals; ++i)
-    {
-        uint16_t value = readw(_pc);
-        _pc += 2;
+    apply_predicate(true);
+}
 
-        if (i < num_args)
-        {
-            value = instruction.operands[i + 1];
-        }
 
-        push(value);
-    }
+void ZMachine::_call(ZInstruction& instruction)
+{
+    call_routine(instruction, true);
 }
 
 
-void ZMachine::_call_vs_4(ZInstruction& instruction) {}
+void ZMachine::_call_vs_4(ZInstruction& instruction)
+{
+    call_routine(instruction, true);
+}
 
 
 void ZMachine::_storew(ZInstruction& instruction)
@@ -1674,62 +3586,78 @@ void ZMachine::_put_prop(ZInstruction& instruction)
 
 void ZMachine::_sread(ZInstruction& instruction)
 {
-    if (_user_input.empty())
+    uint8_t terminator = 0;
+
+    if (read_line(instruction, &ZMachine::_sread, terminator))
     {
-        set_state(State::InputRequested);
+        store_line(instruction.operands[0], instruction.operands[1]);
     }
-    else
+}
+
+
+void ZMachine::_sread_4(ZInstruction& instruction)
+{
+    uint8_t terminator = 0;
+
+    if (read_line(instruction, &ZMachine::_sread_4, terminator))
     {
-        uint16_t text_buffer = instruction.operands[0];
-        uint16_t parse_buffer = instruction.operands[1];
-        std::string user_input = _user_input.front();
-        _user_input.pop_front();
-        _transcript.back() += user_input;
-        uint8_t buffer_len = read(text_buffer);
-        std::transform(user_input.begin(), user_input.end(), user_input.begin(), [](unsigned char c) { return std::tolower(c); });
-        std::strncpy((char*)(_memory + text_buffer + 1), user_input.c_str(), buffer_len);
-        parse(text_buffer, parse_buffer);
+        store_line(instruction.operands[0], instruction.operands[1]);
     }
 }
 
 
-void ZMachine::_sread_4(ZInstruction& instruction) {}
-void ZMachine::_aread_5(ZInstruction& instruction) {}
+void ZMachine::_aread_5(ZInstruction& instruction)
+{
+    uint8_t terminator = 0;
+
+    if (read_line(instruction, &ZMachine::_aread_5, terminator))
+    {
+        store_line(instruction.operands[0], instruction.operand_count > 1 ? instruction.operands[1] : 0);
+        store_result(terminator);
+    }
+}
 
 
 void ZMachine::_print_char(ZInstruction& instruction)
 {
     uint16_t zscii = instruction.operands[0];
-    char ascii;
-
-    if (zscii_to_ascii(ascii, zscii, true))
-    {
-        _linebuffer << ascii;
-    }
+    finish_tables();
+    const ZsciiCodec::Utf8& utf8 = _codec.to_utf8(zscii);
+    print(std::string_view(utf8.bytes, utf8.length));
 }
 
 
 void ZMachine::_print_num(ZInstruction& instruction)
 {
     int16_t number = instruction.operands[0];
-    _linebuffer << number;
+    char digits[8];
+    int length = snprintf(digits, sizeof(digits), "%d", number);
+    print(std::string_view(digits, length));
 }
 
 
 void ZMachine::_random(ZInstruction& instruction)
 {
-    // TODO: Uniformly distributed random numbers
-    int16_t range = (int16_t)instruction.operands[0];
-    int16_t r = 0;
+    // A positive range returns 1..range, otherwise the generator is reseeded and the result is 0: 0 for random,
+    // -S with S < 1000 for the sequence 1..S and other negative values as a seed
+    int32_t range = (int16_t)instruction.operands[0];
+    uint16_t r = 0;
 
     if (range > 0)
     {
-        _random_state = (32309 * _random_state) + 151;
-        r = (_random_state % range) + 1;
+        r = _rng.next((uint16_t)range);
+    }
+    else if (range == 0)
+    {
+        _rng.randomize();
+    }
+    else if (-range < 1000)
+    {
+        _rng.predictable((uint16_t)-range);
     }
     else
     {
-        _random_state = -range;
+        _rng.seed((uint64_t)-range);
     }
 
     store_result(r);
@@ -1752,28 +3680,335 @@ void ZMachine::_pull(ZInstruction& instruction)
 
 void ZMachine::_pull_6(ZInstruction& instruction) {}
 void ZMachine::_split_window(ZInstruction& instruction) {}
-void ZMachine::_set_window(ZInstruction& instruction) {}
-void ZMachine::_call_vs2_4(ZInstruction& instruction) {}
+
+
+void ZMachine::_set_window(ZInstruction& instruction)
+{
+    _window = (uint8_t)instruction.operands[0];
+}
+
+
+void ZMachine::_call_vs2_4(ZInstruction& instruction)
+{
+    call_routine(instruction, true);
+}
+
+
 void ZMachine::_erase_window_4(ZInstruction& instruction) {}
 void ZMachine::_erase_line_4(ZInstruction& instruction) {}
 void ZMachine::_erase_line_6(ZInstruction& instruction) {}
 void ZMachine::_set_cursor_4(ZInstruction& instruction) {}
 void ZMachine::_set_cursor_6(ZInstruction& instruction) {}
-void ZMachine::_get_cursor_4(ZInstruction& instruction) {}
-void ZMachine::_set_text_style_4(ZInstruction& instruction) {}
+
+
+void ZMachine::_get_cursor_4(ZInstruction& instruction)
+{
+    // Windows are laid out by the output sinks, so the machine has no cursor of its own and reports the top left
+    uint16_t array = instruction.operands[0];
+    write_tablew(array, 0, 1);
+    write_tablew(array, 1, 1);
+}
+
+
+void ZMachine::_set_text_style_4(ZInstruction& instruction)
+{
+    // Roman clears all styles, anything else combines with the current style
+    TextStyle::Type style = (TextStyle::Type)instruction.operands[0];
+    _text_style = style ? (_text_style | style) : TextStyle::Roman;
+}
+
+
 void ZMachine::_buffer_mode_4(ZInstruction& instruction) {}
-void ZMachine::_output_stream(ZInstruction& instruction) {}
-void ZMachine::_output_stream_5(ZInstruction& instruction) {}
-void ZMachine::_output_stream_6(ZInstruction& instruction) {}
+
+
+void ZMachine::_output_stream(ZInstruction& instruction)
+{
+    int16_t number = (int16_t)instruction.operands[0];
+    bool select = number > 0;
+    uint16_t flags2 = readw(0x10);
+
+    switch (select ? number : -number)
+    {
+        case 0:
+            break;
+
+        case OutputStream::Screen:
+            _screen_selected = select;
+            break;
+
+        case OutputStream::Transcript:
+            writew(0x10, select ? (flags2 | GameFlags::Transcripting) : (flags2 & ~GameFlags::Transcripting));
+            break;
+
+        case OutputStream::Memory:
+            if (select)
+            {
+                ZCHECK(_memory_stream_depth < 16);
+                _memory_streams[_memory_stream_depth++] = MemoryStream{ instruction.operands[1], 0 };
+            }
+            else if (_memory_stream_depth)
+            {
+                // Closing the stream stores the number of characters written in the table's first word
+                MemoryStream& stream = _memory_streams[--_memory_stream_depth];
+                writew(stream.table, stream.length);
+            }
+            break;
+
+        case OutputStream::CommandScript:
+            _command_script_selected = select;
+            break;
+
+        default:
+            crash("Illegal output stream %d\n", number);
+    }
+}
+
+
+void ZMachine::_output_stream_5(ZInstruction& instruction)
+{
+    _output_stream(instruction);
+}
+
+
+void ZMachine::_output_stream_6(ZInstruction& instruction)
+{
+    // A width makes stream 3 format text into lines for a window, and there's no version 6 screen model to do that
+    if ((int16_t)instruction.operands[0] == OutputStream::Memory && instruction.operand_count > 2)
+    {
+        crash("Formatted memory streams are not supported\n");
+    }
+
+    _output_stream(instruction);
+}
+
+
 void ZMachine::_input_stream(ZInstruction& instruction) {}
 void ZMachine::_sound_effect_5(ZInstruction& instruction) {}
-void ZMachine::_read_char_4(ZInstruction& instruction) {}
-void ZMachine::_scan_table_4(ZInstruction& instruction) {}
-void ZMachine::_not_5(ZInstruction& instruction) {}
-void ZMachine::_call_vn_5(ZInstruction& instruction) {}
-void ZMachine::_call_vn2_5(ZInstruction& instruction) {}
-void ZMachine::_tokenise_5(ZInstruction& instruction) {}
-void ZMachine::_encode_text_5(ZInstruction& instruction) {}
-void ZMachine::_copy_table_5(ZInstruction& instruction) {}
-void ZMachine::_print_table_5(ZInstruction& instruction) {}
-void ZMachine::_check_arg_count_5(ZInstruction& instruction) {}
\ No newline at end of file
+
+
+void ZMachine::_read_char_4(ZInstruction& instruction)
+{
+    if (input_interrupted())
+    {
+        store_result(0);
+        return;
+    }
+
+    uint8_t key = 0;
+
+    if (!_key_queue.empty())
+    {
+        key = (uint8_t)_key_queue[0];
+        _key_queue.erase(0, 1);
+    }
+    else if (!_input_queue.empty())
+    {
+        // Queued lines are read a character at a time, the line break is return
+        key = (uint8_t)_input_queue[0];
+        key = (key == '\n') ? 13 : key;
+        _input_queue.erase(0, 1);
+    }
+    else
+    {
+        uint16_t timeout = instruction.operand_count > 2 ? instruction.operands[1] : 0;
+        uint16_t routine = instruction.operand_count > 2 ? instruction.operands[2] : 0;
+        suspend(instruction, &ZMachine::_read_char_4, timeout, routine);
+        return;
+    }
+
+    store_result(key);
+}
+
+
+
+void ZMachine::_scan_table_4(ZInstruction& instruction)
+{
+    // The form's top bit selects words, the rest is the size of each field in bytes
+    uint16_t x = instruction.operands[0];
+    uint16_t table = instruction.operands[1];
+    uint16_t length = instruction.operands[2];
+    uint8_t form = (instruction.operand_count > 3) ? (uint8_t)instruction.operands[3] : 0x82;
+    uint8_t field_size = form & 0x7F;
+    bool words = (form & 0x80) != 0;
+
+    for (uint16_t i = 0; i < length; ++i)
+    {
+        uint32_t addr = table + i * field_size;
+
+        if ((words ? readw(addr) : read(addr)) == x)
+        {
+            store_result((uint16_t)addr);
+            apply_predicate(true);
+            return;
+        }
+    }
+
+    store_result(0);
+    apply_predicate(false);
+}
+
+
+void ZMachine::_not_5(ZInstruction& instruction)
+{
+    _not(instruction);
+}
+
+
+void ZMachine::_call_vn_5(ZInstruction& instruction)
+{
+    call_routine(instruction, false);
+}
+
+
+void ZMachine::_call_vn2_5(ZInstruction& instruction)
+{
+    call_routine(instruction, false);
+}
+
+
+void ZMachine::_tokenise_5(ZInstruction& instruction)
+{
+    uint16_t text_buffer = instruction.operands[0];
+    uint16_t parse_buffer = instruction.operands[1];
+    uint16_t dictionary_addr = (instruction.operand_count > 2) ? instruction.operands[2] : 0;
+    bool skip_unknown = (instruction.operand_count > 3) && instruction.operands[3];
+    tokenise(text_buffer, parse_buffer, dictionary(dictionary_addr), skip_unknown);
+}
+
+
+void ZMachine::_encode_text_5(ZInstruction& instruction)
+{
+    uint16_t zscii_text = instruction.operands[0];
+    uint16_t length = instruction.operands[1];
+    uint16_t from = instruction.operands[2];
+    uint16_t coded_text = instruction.operands[3];
+
+    ZCHECK((uint32_t)zscii_text + from + length <= _memory_size);
+    uint8_t zchars[12];
+    uint8_t num_zchars = encode_zchars(_memory + zscii_text + from, length, zchars);
+
+    const Dictionary& dict = dictionary(0);
+    uint64_t key = dict.make_key(zchars, num_zchars);
+
+    for (uint8_t w = 0; w < _traits.dictionary_word_length; ++w)
+    {
+        uint8_t shift = (_traits.dictionary_word_length - 1 - w) << 4;
+        write_tablew(coded_text, w, (uint16_t)(key >> shift));
+    }
+}
+
+
+void ZMachine::_copy_table_5(ZInstruction& instruction)
+{
+    // No second table zeroes the first. A negative size copies forwards even if the tables overlap, otherwise the
+    // copy is made as if through a temporary table.
+    uint16_t first = instruction.operands[0];
+    uint16_t second = instruction.operands[1];
+    int16_t size = (int16_t)instruction.operands[2];
+    uint16_t count = (uint16_t)(size < 0 ? -size : size);
+
+    if (second == 0)
+    {
+        for (uint16_t i = 0; i < count; ++i)
+        {
+            write_table(first, i, 0);
+        }
+    }
+    else if (size < 0 || second < first || second >= first + count)
+    {
+        for (uint16_t i = 0; i < count; ++i)
+        {
+            write_table(second, i, read_table(first, i));
+        }
+    }
+    else
+    {
+        for (uint16_t i = count; i > 0; --i)
+        {
+            write_table(second, i - 1, read_table(first, i - 1));
+        }
+    }
+}
+
+
+void ZMachine::_print_table_5(ZInstruction& instruction)
+{
+    // Rows are printed on lines of their own, skip bytes apart
+    uint16_t text = instruction.operands[0];
+    uint16_t width = instruction.operands[1];
+    uint16_t height = (instruction.operand_count > 2) ? instruction.operands[2] : 1;
+    uint16_t skip = (instruction.operand_count > 3) ? instruction.operands[3] : 0;
+
+    if (output_discarded())
+    {
+        return;
+    }
+
+    finish_tables();
+    _print_buffer.clear();
+
+    for (uint16_t row = 0; row < height; ++row)
+    {
+        if (row)
+        {
+            _print_buffer.push_back('\n');
+        }
+
+        for (uint16_t column = 0; column < width; ++column)
+        {
+            const ZsciiCodec::Utf8& utf8 = _codec.to_utf8(read(text + row * (width + skip) + column));
+            _print_buffer.append(utf8.bytes, utf8.length);
+        }
+    }
+
+    print(_print_buffer);
+}
+
+
+void ZMachine::_check_arg_count_5(ZInstruction& instruction)
+{
+    uint16_t argument = instruction.operands[0];
+    uint8_t arg_count = (_locals_base < 0xFFFF) ? (uint8_t)_stack[_locals_base] : 0;
+    apply_predicate(argument <= arg_count);
+}
+
+
+void ZMachine::_log_shift_5(ZInstruction& instruction)
+{
+    uint16_t number = instruction.operands[0];
+    int16_t places = (int16_t)instruction.operands[1];
+    uint16_t result = (places < 0) ? (uint16_t)(number >> -places) : (uint16_t)(number << places);
+    store_result(result);
+}
+
+
+void ZMachine::_art_shift_5(ZInstruction& instruction)
+{
+    int16_t number = (int16_t)instruction.operands[0];
+    int16_t places = (int16_t)instruction.operands[1];
+    // Shifted left as unsigned, a negative number shifted left is undefined
+    int16_t result = (places < 0) ? (int16_t)(number >> -places) : (int16_t)(uint16_t)((uint16_t)number << places);
+    store_result(result);
+}
+
+
+void ZMachine::_set_font_5(ZInstruction& instruction)
+{
+    // Fonts are the output sinks' business, so the story only ever has the normal font. Asking for it, or for the
+    // current font with 0, gets the previous font back, any other font isn't available.
+    uint16_t font = instruction.operands[0];
+    store_result((font == 0 || font == 1) ? 1 : 0);
+}
+
+
+void ZMachine::_save_undo_5(ZInstruction& instruction)
+{
+    // -1 tells the story undo isn't available, sessions are rolled back from their snapshots instead
+    store_result(0xFFFF);
+}
+
+
+void ZMachine::_restore_undo_5(ZInstruction& instruction)
+{
+    store_result(0);
+}
\ No newline at end of file
@@ -1,12 +1,21 @@
 #pragma once
 
+#include <chrono>
 #include <cstdint>
-#include <deque>
+#include <future>
 #include <memory>
-#include <sstream>
+#include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
+#include "alloc_counter.h"
+#include "dictionary.h"
+#include "mapped_file.h"
+#include "output.h"
+#include "random.h"
+#include "story_image.h"
+#include "zscii.h"
 
 namespace InterpreterFlags
 {
@@ -148,6 +157,9 @@ inline uint32_t make_address(uint16_t msw, uint16_t lsw)
 }
 
 
+class SharedStory;
+
+
 class ZMachine
 {
 public:
@@ -185,6 +197,67 @@ public:
         uint8_t max_properties;
     };
 
+    struct PropertyIndexEntry
+    {
+        uint16_t addr;  // Address of the property data, 0 if the object doesn't have the property
+        uint8_t length; // Length of the property data in bytes
+        uint8_t next;   // Next property number in the object's property list, 0 at the end of the list
+    };
+
+    static constexpr uint32_t snapshot_page_size = 256;
+
+    struct SnapshotPage
+    {
+        uint8_t bytes[snapshot_page_size];
+    };
+
+    // Machine state at an input request. Dynamic memory is kept in pages shared with earlier snapshots, so taking a
+    // snapshot copies only the pages written since the last one and the used part of the stack.
+    struct Snapshot
+    {
+        uint16_t release_number;
+        uint8_t serial[6];
+        uint16_t checksum;
+        uint32_t memory_size;       // Bytes of dynamic memory
+        std::vector<std::shared_ptr<const SnapshotPage>> pages;
+        std::shared_ptr<const std::vector<uint8_t>> initial_memory; // Dynamic memory as the story was loaded
+        std::vector<uint16_t> stack;
+        uint32_t pc;
+        uint16_t sp;
+        uint16_t locals_base;
+        ZInstruction instruction;   // The input instruction the machine is waiting in
+        uint16_t input_timeout;
+        uint16_t input_routine;
+        uint8_t window;
+        TextStyle::Type text_style;
+        Random::State random;
+    };
+
+    // How the tables derived from a story are built at load. Parallel builds them as tasks on the shared TaskPool and
+    // waits for them before load returns. Lazy returns once the tasks have started: the codec and dictionary finish in
+    // the background and the machine only waits for them when it first prints or reads input, and the property index
+    // and sibling links are built when first used.
+    enum class TableBuild
+    {
+        Serial,
+        Parallel,
+        Lazy
+    };
+
+    // Microseconds spent in each phase of the last load
+    struct LoadTimes
+    {
+        uint32_t memory;            // Opening the story and finding it in a Blorb file or story image
+        uint32_t codec;             // Each table's build, on whichever thread ran it
+        uint32_t dictionary;
+        uint32_t property_index;
+        uint32_t prev_siblings;
+        uint32_t tables;            // Load's wait for its tables, less than their sum when they're built in parallel
+        uint32_t snapshot;          // Copying initial dynamic memory for snapshots
+        uint32_t total;             // Until load returned
+        uint32_t lazy_wait;         // Time the machine spent waiting for tables after a lazy load returned
+    };
+
     struct Traits
     {
         InstructionHandlers instruction_handlers;
@@ -198,14 +271,84 @@ public:
     ZMachine() = default;
     ~ZMachine();
 
-    bool load(std::vector<uint8_t>& story_file);
+    // Takes over a story image, such as one just decompressed from an archive, without copying it
+    bool load(std::vector<uint8_t>&& story_file);
+
+    // Maps a raw story file, a Blorb file or a story image in place. Images bring the tables built at load with them, so those are
+    // used straight from the mapping instead of being rebuilt.
+    bool load(const char* path);
+
+    // Copies a story file, raw, Blorb or image, into memory backed by the page file rather than taking the buffer
+    // over, so clones get copy on write views of it as they do of a mapped story
+    bool load_shareable(const std::vector<uint8_t>& story_file);
+
+    // Starts a session of a story loaded once for every session playing it. Memory is copied from the story as
+    // clone() does, the story's tables are used in place and the story is kept alive by the machine.
+    bool load(std::shared_ptr<const SharedStory> story);
+
+    // Writes the story and the tables built for it as a story image, to a file or into memory. Call before the first
+    // update, while memory still holds the story as loaded. An image in memory can leave the story out when it's only
+    // kept for use_image_tables on this machine.
+    bool save_image(const char* path);
+    bool save_image(std::vector<uint8_t>& image, bool with_story = true);
+
+    // Switches to the tables in an image of the loaded story, such as one from save_image, instead of the machine's
+    // own. They are used in place, so the image must outlive the machine and its clones.
+    bool use_image_tables(const StoryImage& image);
+
+    // Starts this machine where another one is, usually a template waiting for its first input. A mapped story gets a
+    // fresh copy on write view with the source's dynamic memory copied over it, so static and high memory stay shared;
+    // a story in a buffer is copied whole. Output sinks aren't copied. Tables used in place from a story image belong
+    // to the source's mapping, so the source must outlive its clones. Several machines can clone one source at once,
+    // even while a lazy load of it is still building tables.
+    bool clone(const ZMachine& source);
+
+    // Snapshots can be taken while the machine waits for input, outside any interrupt routine or memory stream, and
+    // restored into a machine that has the same story loaded
+    bool snapshot(Snapshot& snapshot);
+    bool restore(const Snapshot& snapshot);
+    const std::shared_ptr<const std::vector<uint8_t>>& initial_memory() const { return _initial_memory; }
     void reset();
     State state() { return _current_state; }
+    const ZMachineHeader& header() const { return _header; }
+    uint32_t memory_size() const { return _memory_size; }
+
+    // Applies to the loads that follow
+    void set_table_build(TableBuild build) { _table_build = build; }
+
+    // Waits for any tables a lazy load is still building, so the times are complete
+    const LoadTimes& load_times();
 
     State update();
 
-    const std::vector<std::string>& transcript() { return _transcript; }
-    void input(const std::string& user_input);
+    void input(std::string_view user_input);
+
+    // Individual keypresses as ZSCII (8 is delete, 13 is return). read_char takes them as they are, sread edits them
+    // into input_line() until return completes it.
+    void key(uint8_t zscii);
+    std::string_view input_line() const { return _input_line; }
+
+    // Timed input: while input is requested with an interrupt routine, the host calls timer_expired() every
+    // input_timeout() tenths of a second and the routine runs on the next update
+    uint16_t input_timeout() const;
+    void timer_expired();
+
+    // Hosts can seed the generator for repeatable sessions, its state belongs in any snapshot of the machine
+    Random& random() { return _rng; }
+
+    // Output streams 1 (screen), 2 (transcript) and 4 (command script) go to sinks registered by the host, stream 3
+    // is written into Z-machine memory. A null sink discards the stream.
+    void set_output_sink(OutputStream::Type stream, OutputSink* sink);
+    void print(std::string_view text);
+
+    // True when printed text would reach neither a sink nor memory. Print opcodes then skip decoding, so a host that
+    // only wants text for some turns can register its sinks just for those.
+    bool output_discarded() const;
+
+#if defined(ZILG_COUNT_ALLOCATIONS)
+    // Heap allocations made by the machine during the last update, excluding any made by output sinks
+    uint64_t update_allocations() const { return _update_allocations; }
+#endif
 
     // Read and write memory
     uint8_t read(uint32_t addr);
@@ -220,7 +363,8 @@ public:
     uint16_t read_tablew(uint32_t addr, uint16_t index);
     void write_tablew(uint32_t addr, uint16_t index, uint16_t word);
 
-    uint16_t read_string(uint32_t addr, std::vector<char>& str, bool terminate);
+    uint16_t read_string(uint32_t addr, std::string& str);
+    uint16_t string_length(uint32_t addr);
 
     // Read and write variables
     uint16_t readv(uint8_t var);
@@ -233,8 +377,13 @@ public:
     void pusha(uint32_t address);
     uint32_t popa();
 
-    void push_stack_frame();
-    void pop_stack_frame();
+    // A frame's last word holds the number of arguments the routine was called with, and frame_stores_result if the
+    // call has a store byte for its result
+    static constexpr uint16_t frame_stores_result = 0x100;
+
+    void push_stack_frame(uint8_t arg_count, bool store);
+    uint16_t pop_stack_frame();
+    void call_routine(const ZInstruction& instruction, bool store);
 
     // Objects & properties
     uint16_t get_object_ptr(uint16_t object_index);
@@ -251,7 +400,7 @@ public:
     uint16_t get_child(uint16_t object_index);
     void set_child(uint16_t object_index, uint16_t child_index);
 
-    void get_object_short_name(uint16_t object_index, std::vector<char>& str);
+    void get_object_short_name(uint16_t object_index, std::string& str);
 
     uint16_t get_prop_addr(uint16_t object_index, uint8_t property_index);
     uint8_t get_prop_len(uint16_t prop_addr);
@@ -266,10 +415,10 @@ public:
     void store_result(uint16_t value);
     void apply_predicate(bool test);
     void ret(uint16_t result);
-    bool zscii_to_ascii(char& ascii_code, uint16_t zscii_code, bool for_output);
     const char* mnemonic(uint16_t opcode);
     uint32_t unpack_paddr(uint16_t paddr, bool string);
-    void parse(uint16_t text_buffer, uint16_t parse_buffer);
+    uint8_t encode_zchars(const uint8_t* text, size_t length, uint8_t* zchars);
+    void tokenise(uint16_t text_buffer, uint16_t parse_buffer, const Dictionary& dict, bool skip_unknown);
 
     // 2OP Instruction handlers
     void _je(ZInstruction&);
@@ -384,23 +533,118 @@ public:
     void _print_table_5(ZInstruction&);
     void _check_arg_count_5(ZInstruction&);
 
+    // EXTOP Instruction handlers
+    void _log_shift_5(ZInstruction&);
+    void _art_shift_5(ZInstruction&);
+    void _set_font_5(ZInstruction&);
+    void _save_undo_5(ZInstruction&);
+    void _restore_undo_5(ZInstruction&);
+
 private:
     Traits _traits{};
-    uint8_t* _memory = nullptr;
+    std::shared_ptr<const SharedStory> _shared_story{};   // Owns the tables used in place, if the story is shared
+    std::vector<uint8_t> _story_buffer{};
+    MappedFile _story_file{};
+    uint8_t* _memory = nullptr;     // Points into _story_buffer or _story_file
     uint32_t _memory_size = 0;
     uint16_t _stack[64 * 1024];
     ZMachineHeader _header{};
+    ZsciiCodec _codec{};
     uint32_t _pc{};
-    uint32_t _resume_pc{};
+    ZInstruction _suspended_instruction{};
+    InstructionHandler _suspended_handler{};
+    uint16_t _input_timeout{};
+    uint16_t _input_routine{};
+    bool _timer_pending = false;
+    uint16_t _interrupt_frame{};    // _locals_base of a running interrupt routine, 0 if there isn't one
+    uint16_t _interrupt_result{};
+    bool _interrupt_returned = false;
     uint16_t _sp{};
     uint16_t _locals_base{};
     State _current_state = State::Crashed;
-    std::stringstream _linebuffer{};
-    std::vector<std::string> _transcript{};
-    std::deque<std::string> _user_input{};
-    uint16_t _random_state{};
+    std::string _input_queue{}; // Pending lines of input, each terminated by '\n'
+    std::string _key_queue{};   // Pending keypresses
+    std::string _input_line{};  // Line being edited, or the line sread is storing
+    Random _rng{};
+
+    std::shared_ptr<const std::vector<uint8_t>> _initial_memory{};
+    std::vector<std::shared_ptr<const SnapshotPage>> _snapshot_pages{};
+    std::vector<uint8_t> _dirty_pages{};    // Pages of memory written since the last snapshot, by snapshot_page_size
+
+    std::vector<PropertyIndexEntry> _property_index{};
+    std::vector<uint8_t> _property_headers{};       // One bit per address from _property_headers_base
+    std::vector<uint32_t> _property_header_addrs{};
+    const PropertyIndexEntry* _property_entries{};  // _property_index, or the index in a story image
+    const uint8_t* _property_header_bits{};         // _property_headers, or the bits in a story image
+    uint32_t _property_headers_base{};
+    uint32_t _property_headers_size{};
+    uint16_t _indexed_objects{};
+    bool _property_index_dirty = true;
+
+    Dictionary _dictionary{};
+    std::unordered_map<uint16_t, Dictionary> _user_dictionaries{};
+    uint32_t _dictionary_writes_base{};
+    uint32_t _dictionary_writes_size{};
+    bool _dictionaries_dirty = false;
+
+    std::vector<uint16_t> _prev_sibling{};
+    uint32_t _object_entries_base{};
+    uint32_t _object_entries_size{};
+    uint16_t _object_count{};
+    bool _prev_sibling_dirty = true;
+
+    struct MemoryStream
+    {
+        uint16_t table;
+        uint16_t length;
+    };
 
-    void flush_line();
+    OutputSink* _output_sinks[OutputStream::Count]{};
+    bool _screen_selected = true;
+    bool _command_script_selected = false;
+    MemoryStream _memory_streams[16]{};
+    uint8_t _memory_stream_depth{};
+    uint8_t _window{};
+    TextStyle::Type _text_style{};
+    std::string _print_buffer{};
+
+    TableBuild _table_build = TableBuild::Parallel;
+    LoadTimes _load_times{};
+    bool _tables_pending = false;               // A lazy load's codec or dictionary is still being built
+    bool _tables_failed = false;                // A lazy load's tables failed to build, the next update crashes
+    bool _dictionary_built = false;
+    std::shared_future<void> _pending_codec{};  // Shared so clones of a lazily loaded source can wait on them too
+    std::shared_future<void> _pending_dictionary{};
+
+#if defined(ZILG_COUNT_ALLOCATIONS)
+    uint64_t _sink_allocations{};
+    uint64_t _update_allocations{};
+#endif
+
+    uint16_t count_objects();
+    void build_property_index();
+    const PropertyIndexEntry* find_property(uint16_t object_index, uint8_t property_index);
+    void build_prev_siblings();
+    const Dictionary& dictionary(uint16_t addr);
+    void watch_dictionary(const Dictionary& dictionary);
+    uint16_t get_prev_sibling(uint16_t object_index);
+    void unlink_object(uint16_t object_index);
+    void write_object_link(uint32_t addr, uint16_t object_index);
+    void mark_written(uint32_t addr, uint32_t size);
+    void write_sink(OutputStream::Type stream, std::string_view text);
+    void write_memory_stream(std::string_view text);
+    void echo_input(std::string_view text);
+    bool load_memory(uint8_t* memory, size_t size, std::chrono::steady_clock::time_point start);
+    bool unload();
+    bool build_tables();
+    void finish_tables();
+    bool adopt_tables(const StoryImage& image);
+    bool add_image_sections(StoryImageWriter& writer);
+    void suspend(const ZInstruction& instruction, InstructionHandler handler, uint16_t timeout = 0, uint16_t routine = 0);
+    void call_interrupt(uint16_t routine);
+    bool input_interrupted();
+    bool read_line(ZInstruction& instruction, InstructionHandler handler, uint8_t& terminator);
+    void store_line(uint16_t text_buffer, uint16_t parse_buffer);
     void crash(const char* format, ...);
     void set_state(State state);
 };
@@ -0,0 +1,257 @@
+#include "zscii.h"
+
+#include <cstring>
+
+// clang-format off
+static const char* default_alphabet[3] = {
+    "      abcdefghijklmnopqrstuvwxyz",
+    "      ABCDEFGHIJKLMNOPQRSTUVWXYZ",
+    "       \n0123456789.,!?_#'\"/\\-:()"
+};
+
+// Unicode translations for ZSCII 155..223 (standard 1.1, table 1)
+static const uint16_t default_unicode_table[] = {
+    0x0E4, 0x0F6, 0x0FC, 0x0C4, 0x0D6, 0x0DC, 0x0DF, 0x0BB, 0x0AB, 0x0EB, 0x0EF, 0x0FF, 0x0CB, 0x0CF, 0x0E1, 0x0E9,
+    0x0ED, 0x0F3, 0x0FA, 0x0FD, 0x0C1, 0x0C9, 0x0CD, 0x0D3, 0x0DA, 0x0DD, 0x0E0, 0x0E8, 0x0EC, 0x0F2, 0x0F9, 0x0C0,
+    0x0C8, 0x0CC, 0x0D2, 0x0D9, 0x0E2, 0x0EA, 0x0EE, 0x0F4, 0x0FB, 0x0C2, 0x0CA, 0x0CE, 0x0D4, 0x0DB, 0x0E5, 0x0C5,
+    0x0F8, 0x0D8, 0x0E3, 0x0F1, 0x0F5, 0x0C3, 0x0D1, 0x0D5, 0x0E6, 0x0C6, 0x0E7, 0x0C7, 0x0FE, 0x0F0, 0x0DE, 0x0D0,
+    0x0A3, 0x153, 0x152, 0x0A1, 0x0BF
+};
+// clang-format on
+
+
+static void encode_utf8(uint16_t codepoint, ZsciiCodec::Utf8& utf8)
+{
+    if (codepoint == 0)
+    {
+        utf8.length = 0;
+    }
+    else if (codepoint < 0x80)
+    {
+        utf8.length = 1;
+        utf8.bytes[0] = (char)codepoint;
+    }
+    else if (codepoint < 0x800)
+    {
+        utf8.length = 2;
+        utf8.bytes[0] = (char)(0xC0 | (codepoint >> 6));
+        utf8.bytes[1] = (char)(0x80 | (codepoint & 0x3F));
+    }
+    else
+    {
+        utf8.length = 3;
+        utf8.bytes[0] = (char)(0xE0 | (codepoint >> 12));
+        utf8.bytes[1] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+        utf8.bytes[2] = (char)(0x80 | (codepoint & 0x3F));
+    }
+}
+
+
+void ZsciiCodec::build(uint8_t version, const uint8_t* alphabet_table, const std::vector<uint16_t>& unicode_table, bool words)
+{
+    // NOTE: Decoding follows the version 3+ rules; versions 1 and 2 (shift lock, different A2) aren't supported.
+    if (version < 5)
+    {
+        alphabet_table = nullptr;
+    }
+
+    const uint16_t* translations = unicode_table.empty() ? default_unicode_table : unicode_table.data();
+    size_t translation_count = unicode_table.empty() ? sizeof(default_unicode_table) / sizeof(uint16_t) : unicode_table.size();
+
+    // ZSCII -> UTF-8
+    for (uint16_t zscii = 0; zscii < 256; ++zscii)
+    {
+        uint16_t codepoint = 0;
+
+        if (zscii == 13)
+        {
+            codepoint = '\n';
+        }
+        else if (zscii >= 32 && zscii < 127)
+        {
+            codepoint = zscii;
+        }
+        else if (zscii >= 155 && zscii < 252 && (size_t)(zscii - 155) < translation_count)
+        {
+            codepoint = translations[zscii - 155];
+        }
+
+        _unicode[zscii] = codepoint;
+        encode_utf8(codepoint, _utf8[zscii]);
+    }
+
+    // Z-character -> ZSCII, Z-character -> UTF-8
+    for (uint8_t a = 0; a < 3; ++a)
+    {
+        for (uint8_t zchar = 0; zchar < 32; ++zchar)
+        {
+            uint8_t zscii = 0;
+
+            if (zchar == 0)
+            {
+                zscii = ' ';
+            }
+            else if (zchar < 6 || (a == 2 && zchar == 6))
+            {
+                // Abbreviations, shifts and the A2 escape have no output of their own
+                zscii = 0;
+            }
+            else if (a == 2 && zchar == 7)
+            {
+                zscii = 13;
+            }
+            else if (alphabet_table)
+            {
+                zscii = alphabet_table[(a * 26) + zchar - 6];
+            }
+            else
+            {
+                zscii = (uint8_t)default_alphabet[a][zchar];
+            }
+
+            _alphabet[a][zchar] = zscii;
+            _decode[a][zchar] = _utf8[zscii];
+        }
+    }
+
+    // ZSCII -> Z-characters; anything not in an alphabet is a 10-bit escape. Fill in reverse order of preference so
+    // A0 wins over A1 wins over A2 when the same character appears more than once.
+    for (uint16_t zscii = 0; zscii < 256; ++zscii)
+    {
+        _encode[zscii] = ZChars{ 4, { 5, 6, (uint8_t)(zscii >> 5), (uint8_t)(zscii & 0x1F) } };
+    }
+
+    for (int a = 2; a >= 0; --a)
+    {
+        for (uint8_t zchar = 31; zchar >= (a == 2 ? 8 : 6); --zchar)
+        {
+            uint8_t zscii = _alphabet[a][zchar];
+            _encode[zscii] = (a == 0) ? ZChars{ 1, { zchar } } : ZChars{ 2, { (uint8_t)(3 + a), zchar } };
+        }
+    }
+
+    _encode[' '] = ZChars{ 1, { 0 } };
+
+    _mapped_words = nullptr;
+    _words.resize(word_count);
+
+    if (words)
+    {
+        build_words(0, word_count);
+    }
+}
+
+
+void ZsciiCodec::build_words(uint32_t first, uint32_t last)
+{
+    // Whole words: three Z-characters starting in A0 that decode to three or fewer single byte characters and leave
+    // no shift, abbreviation or escape pending.
+    for (uint32_t word = first; word < last; ++word)
+    {
+        DecodedWord& decoded = _words[word];
+        uint8_t a = 0;
+        decoded.length = 0;
+
+        for (int shift = 10; shift >= 0 && decoded.length != slow_path; shift -= 5)
+        {
+            uint8_t zchar = (word >> shift) & 0x1F;
+
+            if (zchar >= 1 && zchar < 4)
+            {
+                decoded.length = slow_path;
+            }
+            else if (zchar >= 4 && zchar < 6)
+            {
+                a = zchar - 3;
+            }
+            else if (a == 2 && zchar == 6)
+            {
+                decoded.length = slow_path;
+            }
+            else if (_decode[a][zchar].length != 1)
+            {
+                decoded.length = slow_path;
+            }
+            else
+            {
+                decoded.text[decoded.length++] = _decode[a][zchar].bytes[0];
+                a = 0;
+            }
+        }
+
+        if (a != 0)
+        {
+            decoded.length = slow_path;
+        }
+    }
+}
+
+
+void ZsciiCodec::serialize(std::vector<uint8_t>& data) const
+{
+    size_t words_size = 0x8000 * sizeof(DecodedWord);
+    data.resize(sizeof(_unicode) + sizeof(_alphabet) + sizeof(_decode) + sizeof(_utf8) + sizeof(_encode) + words_size);
+    uint8_t* dest = data.data();
+
+    memcpy(dest, _unicode, sizeof(_unicode));
+    dest += sizeof(_unicode);
+    memcpy(dest, _alphabet, sizeof(_alphabet));
+    dest += sizeof(_alphabet);
+    memcpy(dest, _decode, sizeof(_decode));
+    dest += sizeof(_decode);
+    memcpy(dest, _utf8, sizeof(_utf8));
+    dest += sizeof(_utf8);
+    memcpy(dest, _encode, sizeof(_encode));
+    dest += sizeof(_encode);
+    memcpy(dest, words(), words_size);
+}
+
+
+bool ZsciiCodec::adopt(const uint8_t* data, size_t size)
+{
+    // The small tables are copied, the 128K word table is the one worth sharing
+    if (size != sizeof(_unicode) + sizeof(_alphabet) + sizeof(_decode) + sizeof(_utf8) + sizeof(_encode) + 0x8000 * sizeof(DecodedWord))
+    {
+        return false;
+    }
+
+    memcpy(_unicode, data, sizeof(_unicode));
+    data += sizeof(_unicode);
+    memcpy(_alphabet, data, sizeof(_alphabet));
+    data += sizeof(_alphabet);
+    memcpy(_decode, data, sizeof(_decode));
+    data += sizeof(_decode);
+    memcpy(_utf8, data, sizeof(_utf8));
+    data += sizeof(_utf8);
+    memcpy(_encode, data, sizeof(_encode));
+    data += sizeof(_encode);
+
+    _words.clear();
+    _words.shrink_to_fit();
+    _mapped_words = (const DecodedWord*)data;
+    return true;
+}
+
+
+uint8_t ZsciiCodec::from_unicode(uint16_t codepoint) const
+{
+    if (codepoint == '\n')
+    {
+        return 13;
+    }
+
+    if (codepoint >= 32 && codepoint < 127)
+    {
+        return (uint8_t)codepoint;
+    }
+
+    for (uint16_t zscii = 155; zscii < 252; ++zscii)
+    {
+        if (_unicode[zscii] == codepoint)
+        {
+            return (uint8_t)zscii;
+        }
+    }
+
+    return 0;
+}
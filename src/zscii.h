@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+// Table driven conversion between Z-characters, ZSCII and UTF-8. Built once when a story is loaded from the
+// story's alphabet table and unicode translation table (or the defaults from the standard).
+class ZsciiCodec
+{
+public:
+    struct Utf8
+    {
+        uint8_t length;
+        char bytes[3];
+    };
+
+    struct ZChars
+    {
+        uint8_t length;
+        uint8_t zchars[4];
+    };
+
+    struct DecodedWord
+    {
+        uint8_t length; // Number of characters in text, or slow_path if the word needs the full decoder
+        char text[3];
+    };
+
+    static constexpr uint8_t slow_path = 0xFF;
+    static constexpr uint32_t word_count = 0x8000;
+
+    // alphabet_table points at the story's 78 byte alphabet table, or null for the default alphabet.
+    // unicode_table holds the ZSCII 155+ translations, or is empty for the default table.
+    void build(uint8_t version, const uint8_t* alphabet_table, const std::vector<uint16_t>& unicode_table, bool words = true);
+
+    // The whole word table is most of the build. Without words, build() leaves it to calls filling in [first, last)
+    // that can run on separate threads once build() has returned.
+    void build_words(uint32_t first, uint32_t last);
+
+    // Flat copy of the built tables for a story image, and tables taken from one. The word table is used in place, so
+    // data must outlive the codec.
+    void serialize(std::vector<uint8_t>& data) const;
+    bool adopt(const uint8_t* data, size_t size);
+
+    // ZSCII code for a Z-character in alphabet 0..2
+    uint8_t alphabet(uint8_t alphabet, uint8_t zchar) const { return _alphabet[alphabet][zchar & 0x1F]; }
+
+    // Output for a Z-character in alphabet 0..2
+    const Utf8& decode(uint8_t alphabet, uint8_t zchar) const { return _decode[alphabet][zchar & 0x1F]; }
+
+    // Output for a whole string word when the decoder starts in alphabet 0 with nothing pending
+    const DecodedWord& decode_word(uint16_t word) const { return words()[word & 0x7FFF]; }
+
+    // Output for a ZSCII code, empty for codes that have no output
+    const Utf8& to_utf8(uint16_t zscii) const { return _utf8[zscii < 256 ? zscii : 0]; }
+
+    // ZSCII code for a unicode character, 0 if it has no ZSCII equivalent
+    uint8_t from_unicode(uint16_t codepoint) const;
+
+    // Z-characters that encode an input ZSCII code
+    const ZChars& encode(uint8_t zscii) const { return _encode[zscii]; }
+
+private:
+    uint8_t _alphabet[3][32]{};
+    Utf8 _decode[3][32]{};
+    Utf8 _utf8[256]{};
+    uint16_t _unicode[256]{};
+    ZChars _encode[256]{};
+    std::vector<DecodedWord> _words;
+    const DecodedWord* _mapped_words = nullptr; // Word table in a story image, used instead of _words
+
+    const DecodedWord* words() const { return _mapped_words ? _mapped_words : _words.data(); }
+};
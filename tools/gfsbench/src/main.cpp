@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gli_file.h"
+
+
+template<typename F>
+void die(const F& f)
+{
+    f();
+    exit(1);
+}
+
+
+void usage()
+{
+    printf("Usage:\n");
+    printf("\tgfsbench [-p passes] [-c chunksize] path...\n");
+    printf("\tPaths are system paths or //<container>//<file>\n");
+}
+
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+static double megabytes_per_second(uint64_t bytes, double seconds)
+{
+    return seconds > 0.0 ? (double)bytes / (1024.0 * 1024.0) / seconds : 0.0;
+}
+
+
+static void bench(GliFileSystem& fs, const char* path, int passes, size_t chunk_size)
+{
+    // Whole-file reads are the baseline the streaming reads are compared against
+    std::vector<uint8_t> contents;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        if (!fs.read_entire_file(path, contents))
+        {
+            printf("%s: Unable to read\n", path);
+            return;
+        }
+    }
+
+    double whole = seconds_since(start);
+    std::vector<uint8_t> chunk(chunk_size);
+    uint64_t streamed = 0;
+    bool mapped = false;
+    start = std::chrono::steady_clock::now();
+
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        GliFile* file = nullptr;
+
+        if (!fs.open(path, file))
+        {
+            printf("%s: Unable to open\n", path);
+            return;
+        }
+
+        mapped = file->map() != nullptr;
+
+        for (size_t count = 0; (count = file->read(chunk.data(), chunk.size())) > 0;)
+        {
+            streamed += count;
+        }
+
+        delete file;
+    }
+
+    double stream = seconds_since(start);
+
+    if (streamed != (uint64_t)contents.size() * passes)
+    {
+        printf("%s: Streamed %llu bytes, expected %llu\n", path, (unsigned long long)streamed,
+               (unsigned long long)contents.size() * passes);
+        return;
+    }
+
+    // Short reads after seeks in both directions, checked against the whole file
+    const int seeks = 1000;
+    const size_t seek_read = 100;
+    std::mt19937_64 random(1);
+    uint8_t buffer[seek_read];
+    int mismatches = 0;
+    GliFile* file = nullptr;
+
+    if (contents.size() < seek_read || !fs.open(path, file))
+    {
+        printf("%s: %zu bytes%s, whole %.0f MB/s, streamed in %zuK chunks %.0f MB/s\n", path, contents.size(),
+               mapped ? " (mapped)" : "", megabytes_per_second(contents.size() * (uint64_t)passes, whole), chunk_size / 1024,
+               megabytes_per_second(streamed, stream));
+        return;
+    }
+
+    start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < seeks; ++i)
+    {
+        uint64_t position = random() % (contents.size() - seek_read + 1);
+
+        if (!file->seek(position) || file->read(buffer, seek_read) != seek_read ||
+            memcmp(buffer, contents.data() + position, seek_read) != 0)
+        {
+            ++mismatches;
+        }
+    }
+
+    double seek = seconds_since(start);
+    delete file;
+
+    printf("%s: %zu bytes%s, whole %.0f MB/s, streamed in %zuK chunks %.0f MB/s, %d seeks %.1f us each, %d mismatched\n",
+           path, contents.size(), mapped ? " (mapped)" : "", megabytes_per_second(contents.size() * (uint64_t)passes, whole),
+           chunk_size / 1024, megabytes_per_second(streamed, stream), seeks, seek * 1000000.0 / seeks, mismatches);
+}
+
+
+int main(int argc, char** argv)
+{
+    int passes = 5;
+    size_t chunk_size = 64 * 1024;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg(argv[i]);
+
+        if (arg == "-p" || arg == "-c")
+        {
+            if (++i == argc || atoi(argv[i]) <= 0)
+            {
+                die(usage);
+            }
+
+            if (arg == "-p")
+            {
+                passes = atoi(argv[i]);
+            }
+            else
+            {
+                chunk_size = (size_t)atoi(argv[i]);
+            }
+        }
+        else if (arg[0] == '-')
+        {
+            die(usage);
+        }
+        else
+        {
+            paths.push_back(arg);
+        }
+    }
+
+    if (paths.empty())
+    {
+        die(usage);
+    }
+
+    // Every pass reads the file again rather than hitting the cache
+    static GliFileSystem fs;
+    fs.set_cache_budget(0);
+
+    for (const std::string& path : paths)
+    {
+        bench(fs, path.c_str(), passes, chunk_size);
+    }
+
+    fs.shutdown();
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+
+#include "zmachine.h"
+
+
+template<typename F>
+void die(const F& f)
+{
+    f();
+    exit(1);
+}
+
+
+void usage()
+{
+    printf("Usage:\n");
+    printf("\tzimg -o outputfile storyfile\n");
+}
+
+
+int main(int argc, char** argv)
+{
+    std::string input;
+    std::string output;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg(argv[i]);
+
+        if (arg[0] == '-')
+        {
+            if (arg == "-o" && output.empty())
+            {
+                if (++i == argc)
+                {
+                    die(usage);
+                }
+
+                output = argv[i];
+            }
+            else
+            {
+                die(usage);
+            }
+        }
+        else if (input.empty())
+        {
+            input = arg;
+        }
+        else
+        {
+            die(usage);
+        }
+    }
+
+    if (input.empty() || output.empty())
+    {
+        die(usage);
+    }
+
+    // Loading builds every table the image carries; the machine never runs, so memory is still the story as loaded
+    static ZMachine zm;
+
+    if (!zm.load(input.c_str()))
+    {
+        die([&]() { printf("Unable to load story file [%s]\n", input.c_str()); });
+    }
+
+    if (!zm.save_image(output.c_str()))
+    {
+        die([&]() { printf("Unable to write story image [%s]\n", output.c_str()); });
+    }
+
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+
+#include "replay.h"
+#include "zmachine.h"
+
+
+template<typename F>
+void die(const F& f)
+{
+    f();
+    exit(1);
+}
+
+
+void usage()
+{
+    printf("Usage:\n");
+    printf("\tzreplay storyfile sessionlog\n");
+}
+
+
+int main(int argc, char** argv)
+{
+    std::string story;
+    std::string session;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg(argv[i]);
+
+        if (arg[0] == '-')
+        {
+            die(usage);
+        }
+        else if (story.empty())
+        {
+            story = arg;
+        }
+        else if (session.empty())
+        {
+            session = arg;
+        }
+        else
+        {
+            die(usage);
+        }
+    }
+
+    if (story.empty() || session.empty())
+    {
+        die(usage);
+    }
+
+    // Built with ZILG_COUNT_ALLOCATIONS, so the replay also fails at the first warmed up update that allocates
+    static ZMachine zm;
+    static SessionReplayer replayer;
+
+    if (!zm.load(story.c_str()))
+    {
+        die([&]() { printf("Unable to load story file [%s]\n", story.c_str()); });
+    }
+
+    if (!replayer.load(session.c_str()))
+    {
+        die([&]() { printf("Unable to load session log [%s]\n", session.c_str()); });
+    }
+
+    if (!replayer.run(zm))
+    {
+        die([&]() { printf("Replay failed at update %zu\n", replayer.updates()); });
+    }
+
+    printf("Replayed %zu updates\n", replayer.updates());
+    return 0;
+}